@@ -1,4 +1,4 @@
-from typing import Any, Iterable, Optional
+from typing import Any, Iterable, Optional, Union
 
 
 class Queue:
@@ -7,11 +7,28 @@ class Queue:
     This queue is made up of a linked list of nodes, each containing a queue.
     """
 
-    def __init__(self, iterable: Optional[Iterable] = None) -> None:
+    def __init__(
+        self,
+        iterable: Optional[Iterable] = None,
+        *,
+        max_chunk: int = 256,
+        huge_pages: bool = False,
+    ) -> None:
         """Initialize the Queue object.
 
+        The first node holds 8 elements and each following node doubles in
+        size until it reaches max_chunk, so small queues stay small.
+        Nodes of 64 elements or more start on a cache line.
+
         :param iterable (Optional[Iterable], optional): An iterable to
         initialize the Queue with. Defaults to None
+        :param max_chunk (int, optional): The largest number of elements
+        held by one node, rounded up to a power of two between 8 and
+        1048576. Defaults to 256
+        :param huge_pages (bool, optional): Carve nodes of max_chunk
+        elements out of 2 MiB aligned regions the OS may back with huge
+        pages, which saves TLB misses when scanning queues of millions of
+        items. Defaults to False
         :param self:
         """
         pass
@@ -40,6 +57,25 @@ class Queue:
         """
         pass
 
+    def splice(self, other) -> None:
+        """Move every element of another Queue onto the front of the Queue,
+        leaving the other Queue empty. Chunks are relinked rather than
+        copied, so this takes constant time for a Queue.
+
+        :param other: The Queue of the same type to take the elements from.
+        :param self:
+        """
+        pass
+
+    def __iadd__(self, other: Iterable[Any]):
+        """Splice another Queue of the same type, or extend with any other
+        iterable.
+
+        :param other: (Iterable[Any]): The elements to be enqueued.
+        :return: The Queue itself.
+        """
+        pass
+
     def __len__(self) -> int:
         pass
 
@@ -60,7 +96,9 @@ class Queue:
         pass
 
     def copy(self):
-        """Return a shallow copy of the Queue.
+        """Return a shallow copy of the Queue. The copy shares its storage
+        with the Queue, a chunk is only duplicated once either side writes
+        to it.
 
         :return: A shallow copy of the Queue object.
         """
@@ -73,6 +111,24 @@ class Queue:
         """
         pass
 
+    def __sizeof__(self) -> int:
+        """Return the size of the Queue in memory, in bytes, including the
+        storage of its items. Storage shared with copies is split evenly
+        between them.
+
+        :return: The size of the Queue in bytes.
+        """
+        pass
+
+    def memory_usage(self) -> dict:
+        """Split the size of the Queue into the bytes used to hold items and
+        the spare bytes of free slots.
+
+        :return: A dict with the keys 'used' and 'spare', which add up to
+        __sizeof__().
+        """
+        pass
+
 
 class QueueC:
     """
@@ -80,15 +136,43 @@ class QueueC:
     This queue is made up a single contiguous container.
     """
 
-    def __init__(self, iterable: Optional[Iterable] = None) -> None:
+    def __init__(
+        self,
+        iterable: Optional[Iterable] = None,
+        *,
+        maxlen: Optional[int] = None,
+    ) -> None:
         """Initialize the Queue object.
 
+        A Queue with a maxlen works as a ring buffer. Its storage is allocated
+        once, and enqueueing onto a full Queue drops the oldest element
+        instead of growing.
+
         :param iterable (Optional[Iterable], optional): An iterable to
         initialize the Queue with. Defaults to None
+        :param maxlen (Optional[int], optional): The largest number of
+        elements held at once, None for an unbounded Queue. Defaults to None
         :param self:
         """
         pass
 
+    @property
+    def maxlen(self) -> Optional[int]:
+        """The largest number of elements held at once, None if unbounded."""
+        pass
+
+    @property
+    def dropped(self) -> int:
+        """The number of elements dropped to stay within maxlen."""
+        pass
+
+    def snapshot(self) -> list:
+        """Return a list of the elements in the Queue, oldest first.
+
+        :return: A new list holding the elements of the Queue.
+        """
+        pass
+
     def enqueue(self, item: Any) -> None:
         """Add an item to the front of the Queue.
 
@@ -113,6 +197,25 @@ class QueueC:
         """
         pass
 
+    def splice(self, other) -> None:
+        """Move every element of another Queue onto the front of the Queue,
+        leaving the other Queue empty. The items are bulk copied into
+        this Queue's ring, which takes O(len(other)) time.
+
+        :param other: The Queue of the same type to take the elements from.
+        :param self:
+        """
+        pass
+
+    def __iadd__(self, other: Iterable[Any]):
+        """Splice another Queue of the same type, or extend with any other
+        iterable.
+
+        :param other: (Iterable[Any]): The elements to be enqueued.
+        :return: The Queue itself.
+        """
+        pass
+
     def __len__(self) -> int:
         pass
 
@@ -133,7 +236,9 @@ class QueueC:
         pass
 
     def copy(self):
-        """Return a shallow copy of the Queue.
+        """Return a shallow copy of the Queue. The copy shares its storage
+        with the Queue, a chunk is only duplicated once either side writes
+        to it.
 
         :return: A shallow copy of the Queue object.
         """
@@ -146,17 +251,54 @@ class QueueC:
         """
         pass
 
+    def __sizeof__(self) -> int:
+        """Return the size of the Queue in memory, in bytes, including the
+        storage of its items. Storage shared with copies is split evenly
+        between them.
+
+        :return: The size of the Queue in bytes.
+        """
+        pass
+
+    def memory_usage(self) -> dict:
+        """Split the size of the Queue into the bytes used to hold items and
+        the spare bytes of free slots.
+
+        :return: A dict with the keys 'used' and 'spare', which add up to
+        __sizeof__().
+        """
+        pass
+
 
 class LockQueue(Queue):
     """
     A Queue class that implements a FIFO data structure with locking.
     """
 
-    def __init__(self, iterable: Optional[Iterable] = None) -> None:
+    def __init__(
+        self,
+        iterable: Optional[Iterable] = None,
+        *,
+        spin: int = 8,
+        combining: bool = False,
+    ) -> None:
         """Initialize the LockQueue object.
 
+        A thread waiting for the lock first retries ``spin`` times, then
+        parks with the GIL released until the lock is free.
+
+        With ``combining`` enabled, enqueue and dequeue are posted to
+        per-thread slots and the thread that holds the lock applies all
+        posted operations in one pass. This keeps throughput up with many
+        producers.
+
         :param iterable (Optional[Iterable], optional): An iterable to
         initialize the LockQueue with. Defaults to None
+        :param spin (int, optional): Attempts at taking the lock before a
+        thread parks, can be changed later through the ``spin`` attribute.
+        Defaults to 8, or 128 on free-threaded builds
+        :param combining (bool, optional): Batch enqueue and dequeue through
+        flat combining. Defaults to False
         :param self:
         """
         pass
@@ -168,3 +310,375 @@ class LockQueue(Queue):
         is empty.
         """
         pass
+
+
+class IndexedQueue:
+    """
+    A Queue class that implements a FIFO data structure which keeps a hash
+    index of the items it holds, so membership tests and counts are O(1).
+    Items must be hashable. It wraps a Queue rather than subclassing it and
+    supports indexing, len(), is_empty, dequeue, extend and copy like one.
+    """
+
+    def __init__(
+        self, iterable: Optional[Iterable] = None, unique: bool = False
+    ) -> None:
+        """Initialize the IndexedQueue object.
+
+        :param iterable (Optional[Iterable], optional): An iterable to
+        initialize the IndexedQueue with. Defaults to None
+        :param unique (bool, optional): Skip items that are already in the
+        IndexedQueue when they are enqueued. Defaults to False
+        :param self:
+        """
+        pass
+
+    def enqueue(self, item: Any) -> bool:
+        """Add an item to the front of the IndexedQueue.
+
+        :param item: (Any): The item to be added to the IndexedQueue.
+        :return: False if the item was skipped as a duplicate, True otherwise.
+        """
+        pass
+
+    def count(self, item: Any) -> int:
+        """Return the number of occurrences of an item.
+
+        :param item: (Any): The item to count.
+        :return: The number of times the item is in the IndexedQueue.
+        """
+        pass
+
+
+class WindowQueue:
+    """
+    A bounded FIFO queue of numbers which keeps running aggregates of the
+    numbers it holds. Enqueueing onto a full WindowQueue evicts the oldest
+    number. The numbers are stored unboxed as int64 until the first float
+    arrives or an integer sum would overflow, from then on they are stored
+    as floats.
+    """
+
+    def __init__(
+        self, maxlen: int, aggregates: Optional[Iterable[str]] = None
+    ) -> None:
+        """Initialize the WindowQueue object.
+
+        :param maxlen (int): The largest number of values held at once.
+        :param aggregates (Optional[Iterable[str]], optional): The
+        aggregates to keep up to date, any of 'sum', 'mean', 'min' and
+        'max'. Defaults to all of them
+        :param self:
+        """
+        pass
+
+    @property
+    def sum(self) -> Union[int, float]:
+        """The sum of the values in the WindowQueue.
+
+        :raises ValueError: When neither 'sum' nor 'mean' is tracked.
+        """
+        pass
+
+    @property
+    def mean(self) -> Optional[float]:
+        """The mean of the values in the WindowQueue, None if it is empty.
+
+        :raises ValueError: When neither 'sum' nor 'mean' is tracked.
+        """
+        pass
+
+    @property
+    def min(self) -> Union[int, float, None]:
+        """The smallest value in the WindowQueue, None if it is empty.
+
+        :raises ValueError: When 'min' is not tracked.
+        """
+        pass
+
+    @property
+    def max(self) -> Union[int, float, None]:
+        """The largest value in the WindowQueue, None if it is empty.
+
+        :raises ValueError: When 'max' is not tracked.
+        """
+        pass
+
+    def enqueue(self, item: Union[int, float]) -> None:
+        """Add a number to the front of the WindowQueue, evicting the oldest
+        one once maxlen numbers are held.
+
+        :param item: (Union[int, float]): The number to be added.
+        """
+        pass
+
+    def dequeue(self) -> Union[int, float]:
+        """Remove and return the oldest number in the WindowQueue.
+
+        :return: The number removed from the WindowQueue.
+        """
+        pass
+
+    def extend(self, items: Iterable[Union[int, float]]) -> None:
+        """Enqueue a sequence of numbers from an iterator.
+
+        :param items: (Iterable[Union[int, float]]): An iterable containing
+        the numbers to be enqueued.
+        """
+        pass
+
+
+class BroadcastSubscriber:
+    """
+    A read cursor into a BroadcastQueue, created by
+    BroadcastQueue.subscribe(). Every subscriber sees every item enqueued
+    after it subscribed, in order.
+    """
+
+    @property
+    def dropped(self) -> int:
+        """The number of items this subscriber skipped under the 'drop' lag
+        policy."""
+        pass
+
+    @property
+    def detached(self) -> bool:
+        """True once the subscriber was detached under the 'detach' lag
+        policy."""
+        pass
+
+    def dequeue(self) -> Any:
+        """Return the next item this subscriber has not seen yet.
+
+        :raises IndexError: When the subscriber has seen every item.
+        :raises RuntimeError: When the subscriber is closed or detached.
+        :return: The next item of the BroadcastQueue.
+        """
+        pass
+
+    def close(self) -> None:
+        """Unsubscribe, releasing the items only this subscriber still
+        needed."""
+        pass
+
+    def __len__(self) -> int:
+        """Return the number of items this subscriber has not seen yet.
+
+        :return: The number of pending items.
+        """
+        pass
+
+    def is_empty(self) -> bool:
+        """Check if this subscriber has seen every item.
+
+        :return: True if no items are pending, False otherwise.
+        """
+        pass
+
+
+class BroadcastQueue:
+    """
+    A FIFO queue with many readers. Items are stored once in a shared ring
+    and every subscriber reads them through its own cursor, a slot is
+    released once the slowest subscriber has passed it. Items enqueued
+    while there are no subscribers are discarded.
+    """
+
+    def __init__(self, maxlen: Optional[int] = None, lag: str = "block") -> None:
+        """Initialize the BroadcastQueue object.
+
+        :param maxlen (Optional[int], optional): The largest number of items
+        held at once. Defaults to None, which means unbounded
+        :param lag (str, optional): What a full BroadcastQueue does with
+        the slowest subscriber when an item is enqueued. 'block' waits
+        for it to read, 'drop' skips it past the oldest item and 'detach'
+        unsubscribes it. Defaults to 'block'
+        :param self:
+        """
+        pass
+
+    @property
+    def subscribers(self) -> int:
+        """The number of subscribers attached to the BroadcastQueue."""
+        pass
+
+    def enqueue(self, item: Any) -> None:
+        """Publish an item to every subscriber.
+
+        :param item: (Any): The item to be added.
+        """
+        pass
+
+    def extend(self, items: Iterable[Any]) -> None:
+        """Publish a sequence of items from an iterator.
+
+        :param items: (Iterable[Any]): An iterable containing the items to
+        be enqueued.
+        """
+        pass
+
+    def subscribe(self) -> BroadcastSubscriber:
+        """Create a subscriber which sees every item enqueued from now on.
+
+        :return: The new BroadcastSubscriber.
+        """
+        pass
+
+    def __len__(self) -> int:
+        """Return the number of items held for the slowest subscriber.
+
+        :return: The number of items in the BroadcastQueue.
+        """
+        pass
+
+
+class DelayQueue:
+    """
+    A queue handing out items once their deadline has passed. Deadlines are
+    read against time.monotonic() and rounded up to a whole tick of the
+    resolution, so items are never handed out early and at most one tick
+    late. Items are kept in a hierarchical timer wheel, which makes adding
+    and expiring an item O(1).
+    """
+
+    def __init__(self, resolution: float = 0.001) -> None:
+        """Initialize the DelayQueue object.
+
+        :param resolution (float, optional): The length of a tick in
+        seconds. Defaults to 0.001
+        :param self:
+        """
+        pass
+
+    def enqueue_at(self, deadline: float, item: Any) -> None:
+        """Add an item to be handed out once time.monotonic() reaches
+        deadline.
+
+        :param deadline: (float): The time.monotonic() reading the item is
+        due at.
+        :param item: (Any): The item to be added.
+        """
+        pass
+
+    def enqueue_after(self, delay: float, item: Any) -> None:
+        """Add an item to be handed out delay seconds from now.
+
+        :param delay: (float): The number of seconds until the item is due.
+        :param item: (Any): The item to be added.
+        """
+        pass
+
+    def pop_ready(self, now: Optional[float] = None) -> list:
+        """Remove and return every item whose deadline has passed, in the
+        order of their deadlines.
+
+        :param now: (Optional[float], optional): The time.monotonic() reading
+        to expire items at. Defaults to the current time
+        :return: A list of the expired items.
+        """
+        pass
+
+    def get(self, timeout: Optional[float] = None) -> Any:
+        """Remove and return the next item once its deadline has passed.
+        The GIL is released while waiting.
+
+        :param timeout: (Optional[float], optional): The most seconds to
+        wait. Defaults to None, which waits until an item is due
+        :return: The expired item, None if timeout seconds passed first.
+        """
+        pass
+
+    def __len__(self) -> int:
+        """Return the number of items in the DelayQueue, due or not.
+
+        :return: The number of items in the DelayQueue.
+        """
+        pass
+
+    def is_empty(self) -> bool:
+        """Check if the DelayQueue is empty.
+
+        :return: True if the DelayQueue is empty, False otherwise.
+        """
+        pass
+
+
+class WorkStealingPool:
+    """
+    Task deques for a thread pool, one per worker. A worker pushes and pops
+    tasks at its own end of its deque without locking, while idle workers
+    steal the oldest tasks of a random other worker, so the workers only
+    contend once one of them runs out of work. Tasks submitted from outside
+    the workers wait in a shared queue which workers drain in batches.
+
+    push and pop may only be called for a worker from the thread running it.
+    """
+
+    def __init__(self, workers: int, batch: int = 32) -> None:
+        """Initialize the WorkStealingPool object.
+
+        :param workers (int): The number of workers, each gets a deque.
+        :param batch (int, optional): The most tasks a worker takes at
+        once from another worker or from the submitted tasks. Defaults
+        to 32
+        :param self:
+        """
+        pass
+
+    def submit(self, task: Any) -> None:
+        """Add a task from outside the workers, any worker may run it.
+
+        :param task: (Any): The task to be added.
+        """
+        pass
+
+    def push(self, worker: int, task: Any) -> None:
+        """Add a task to the deque of a worker.
+
+        :param worker: (int): The index of the calling worker.
+        :param task: (Any): The task to be added.
+        """
+        pass
+
+    def pop(self, worker: int) -> Any:
+        """Remove and return the newest task of a worker.
+
+        :param worker: (int): The index of the calling worker.
+        :return: The task, None if the worker has none.
+        """
+        pass
+
+    def steal(self, worker: int, batch: Optional[int] = None) -> Any:
+        """Take the oldest tasks of a random other worker, up to batch but
+        no more than half of them. One is returned and the rest are pushed
+        onto the deque of the calling worker.
+
+        :param worker: (int): The index of the calling worker.
+        :param batch: (Optional[int], optional): The most tasks to take.
+        Defaults to the batch of the pool
+        :return: A stolen task, None if no other worker has any.
+        """
+        pass
+
+    def get(self, worker: int) -> Any:
+        """Return the next task for a worker, taken from its own deque,
+        then from the submitted tasks and then by stealing.
+
+        :param worker: (int): The index of the calling worker.
+        :return: The task, None if there is none anywhere.
+        """
+        pass
+
+    def __len__(self) -> int:
+        """Return the number of tasks waiting in the WorkStealingPool.
+
+        :return: The number of tasks in the WorkStealingPool.
+        """
+        pass
+
+    def is_empty(self) -> bool:
+        """Check if the WorkStealingPool is empty.
+
+        :return: True if no task is waiting, False otherwise.
+        """
+        pass
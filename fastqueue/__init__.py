@@ -1,3 +1,21 @@
-__all__ = "Queue", "QueueC", "LockQueue"
+__all__ = (
+    "Queue",
+    "QueueC",
+    "LockQueue",
+    "IndexedQueue",
+    "WindowQueue",
+    "BroadcastQueue",
+    "DelayQueue",
+    "WorkStealingPool",
+)
 
-from _fastqueue import Queue, QueueC, LockQueue
+from _fastqueue import (
+    Queue,
+    QueueC,
+    LockQueue,
+    IndexedQueue,
+    WindowQueue,
+    BroadcastQueue,
+    DelayQueue,
+    WorkStealingPool,
+)
@@ -5,19 +5,43 @@ fastqueue
 * Queue
 * QueueC
 * LockQueue
+* IndexedQueue
+* WindowQueue
+* BroadcastQueue
+* DelayQueue
+* WorkStealingPool
 
 """
-from typing import Any, Optional
+from typing import Any, Optional, Union
 from collections.abc import Iterable
 from typing_extensions import Self
 
-__all__ = "Queue", "QueueC", "LockQueue"
+__all__ = (
+    "Queue",
+    "QueueC",
+    "LockQueue",
+    "IndexedQueue",
+    "WindowQueue",
+    "BroadcastQueue",
+    "DelayQueue",
+    "WorkStealingPool",
+)
 
 class Queue:
-    def __init__(self, iterable: Optional[Iterable] = None) -> None: ...
+    max_chunk: int
+    huge_pages: bool
+    def __init__(
+        self,
+        iterable: Optional[Iterable] = None,
+        *,
+        max_chunk: int = 256,
+        huge_pages: bool = False,
+    ) -> None: ...
     def enqueue(self, item: Any) -> None: ...
     def dequeue(self) -> Any: ...
     def extend(self, items: Iterable[Any]) -> None: ...
+    def splice(self, other: Self) -> None: ...
+    def __iadd__(self, other: Iterable[Any]) -> Self: ...
     def __len__(self) -> int: ...
     def is_empty(self) -> bool: ...
     def __getitem__(self, index: int) -> Any: ...
@@ -25,12 +49,25 @@ class Queue:
     def __contains__(self, item: Any) -> bool: ...
     def copy(self) -> Self: ...
     def __copy__(self) -> Self: ...
+    def __sizeof__(self) -> int: ...
+    def memory_usage(self) -> dict[str, int]: ...
 
 class QueueC:
-    def __init__(self, iterable: Optional[Iterable] = None) -> None: ...
+    dropped: int
+    def __init__(
+        self,
+        iterable: Optional[Iterable] = None,
+        *,
+        maxlen: Optional[int] = None,
+    ) -> None: ...
+    @property
+    def maxlen(self) -> Optional[int]: ...
+    def snapshot(self) -> list[Any]: ...
     def enqueue(self, item: Any) -> None: ...
     def dequeue(self) -> Any: ...
     def extend(self, items: Iterable[Any]) -> None: ...
+    def splice(self, other: Self) -> None: ...
+    def __iadd__(self, other: Iterable[Any]) -> Self: ...
     def __len__(self) -> int: ...
     def is_empty(self) -> bool: ...
     def __getitem__(self, index: int) -> Any: ...
@@ -38,6 +75,113 @@ class QueueC:
     def __contains__(self, item: Any) -> bool: ...
     def copy(self) -> Self: ...
     def __copy__(self) -> Self: ...
+    def __sizeof__(self) -> int: ...
+    def memory_usage(self) -> dict[str, int]: ...
 
 class LockQueue(Queue):
+    spin: int
+    def __init__(
+        self,
+        iterable: Optional[Iterable] = None,
+        *,
+        spin: int = ...,
+        combining: bool = False,
+    ) -> None: ...
+    @property
+    def combining(self) -> bool: ...
     def get(self) -> Any: ...
+
+class IndexedQueue:
+    def __init__(
+        self, iterable: Optional[Iterable] = None, unique: bool = False
+    ) -> None: ...
+    @property
+    def unique(self) -> bool: ...
+    def enqueue(self, item: Any) -> bool: ...
+    def dequeue(self) -> Any: ...
+    def extend(self, items: Iterable[Any]) -> None: ...
+    def count(self, item: Any) -> int: ...
+    def __len__(self) -> int: ...
+    def is_empty(self) -> bool: ...
+    def __getitem__(self, index: int) -> Any: ...
+    def __setitem__(self, index: int, item: Any) -> None: ...
+    def __contains__(self, item: Any) -> bool: ...
+    def copy(self) -> Self: ...
+    def __copy__(self) -> Self: ...
+    def __sizeof__(self) -> int: ...
+    def memory_usage(self) -> dict[str, int]: ...
+
+class WindowQueue:
+    def __init__(
+        self, maxlen: int, aggregates: Optional[Iterable[str]] = None
+    ) -> None: ...
+    @property
+    def maxlen(self) -> int: ...
+    @property
+    def sum(self) -> Union[int, float]: ...
+    @property
+    def mean(self) -> Optional[float]: ...
+    @property
+    def min(self) -> Union[int, float, None]: ...
+    @property
+    def max(self) -> Union[int, float, None]: ...
+    def enqueue(self, item: Union[int, float]) -> None: ...
+    def dequeue(self) -> Union[int, float]: ...
+    def extend(self, items: Iterable[Union[int, float]]) -> None: ...
+    def __len__(self) -> int: ...
+    def is_empty(self) -> bool: ...
+    def __getitem__(self, index: int) -> Union[int, float]: ...
+    def __sizeof__(self) -> int: ...
+
+class BroadcastSubscriber:
+    @property
+    def dropped(self) -> int: ...
+    @property
+    def detached(self) -> bool: ...
+    def dequeue(self) -> Any: ...
+    def close(self) -> None: ...
+    def __len__(self) -> int: ...
+    def is_empty(self) -> bool: ...
+
+class BroadcastQueue:
+    def __init__(
+        self, maxlen: Optional[int] = None, lag: str = "block"
+    ) -> None: ...
+    @property
+    def maxlen(self) -> Optional[int]: ...
+    @property
+    def lag(self) -> str: ...
+    @property
+    def subscribers(self) -> int: ...
+    def enqueue(self, item: Any) -> None: ...
+    def extend(self, items: Iterable[Any]) -> None: ...
+    def subscribe(self) -> BroadcastSubscriber: ...
+    def __len__(self) -> int: ...
+    def __sizeof__(self) -> int: ...
+
+class DelayQueue:
+    def __init__(self, resolution: float = 0.001) -> None: ...
+    @property
+    def resolution(self) -> float: ...
+    def enqueue_at(self, deadline: float, item: Any) -> None: ...
+    def enqueue_after(self, delay: float, item: Any) -> None: ...
+    def pop_ready(self, now: Optional[float] = None) -> list[Any]: ...
+    def get(self, timeout: Optional[float] = None) -> Any: ...
+    def __len__(self) -> int: ...
+    def is_empty(self) -> bool: ...
+    def __sizeof__(self) -> int: ...
+
+class WorkStealingPool:
+    def __init__(self, workers: int, batch: int = 32) -> None: ...
+    @property
+    def workers(self) -> int: ...
+    @property
+    def batch(self) -> int: ...
+    def submit(self, task: Any) -> None: ...
+    def push(self, worker: int, task: Any) -> None: ...
+    def pop(self, worker: int) -> Any: ...
+    def steal(self, worker: int, batch: Optional[int] = None) -> Any: ...
+    def get(self, worker: int) -> Any: ...
+    def __len__(self) -> int: ...
+    def is_empty(self) -> bool: ...
+    def __sizeof__(self) -> int: ...
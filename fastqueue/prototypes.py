@@ -1,13 +1,13 @@
 """Prototype implementations of a Queue.
 
-* LLQueue   Each element is stored as a Link List Node
+* LLQueue   Each element is stored as a Link List Node carved from a slab
 * ContQueue   Each element is stored contiguous in memory
 
 """
 
 from ctypes import *
 from pathlib import *
-from typing import Any
+from typing import Any, Iterable, List
 
 
 # Matt's Linked List Queue
@@ -26,8 +26,9 @@ class LLNodeQueue(Structure):
     ]
 
 
+# The bulk entry points build Python objects, so the GIL must stay held
 __libfile = Path(__file__).parent / "cllqueue.so"
-llqueue_lib = CDLL(str(__libfile))
+llqueue_lib = PyDLL(str(__libfile))
 
 llqueue_lib.new_node_queue.argtypes = []
 llqueue_lib.new_node_queue.restype = POINTER(LLNodeQueue)
@@ -41,6 +42,12 @@ llqueue_lib.enqueue.restype = None
 llqueue_lib.dequeue.argtypes = [POINTER(LLNodeQueue)]
 llqueue_lib.dequeue.restype = py_object
 
+llqueue_lib.enqueue_many.argtypes = [POINTER(LLNodeQueue), py_object]
+llqueue_lib.enqueue_many.restype = c_ssize_t
+
+llqueue_lib.dequeue_many.argtypes = [POINTER(LLNodeQueue), py_object, c_ssize_t]
+llqueue_lib.dequeue_many.restype = c_ssize_t
+
 llqueue_lib.free_q.argtypes = [POINTER(LLNodeQueue)]
 llqueue_lib.free_q.restype = None
 
@@ -66,9 +73,17 @@ class LLQueue:
             raise IndexError
         return llqueue_lib.dequeue(self.queue)
 
+    def enqueue_many(self, items: Iterable[Any]) -> int:
+        return llqueue_lib.enqueue_many(self.queue, items)
+
+    def dequeue_many(self, count: int) -> List[Any]:
+        items = []
+        llqueue_lib.dequeue_many(self.queue, items, count)
+        return items
+
     def clear(self):
         llqueue_lib.free_q(self.queue)
-        self.queue = llqueue_lib.new__queue()
+        self.queue = llqueue_lib.new_node_queue()
 
     def __del__(self):
         llqueue_lib.free_q(self.queue)
@@ -8,9 +8,14 @@
 #endif
 
 #include <Python.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
 // Matt's C Linked List Queue
 
 QUEUE_LIBRARY_API typedef struct node {
@@ -18,23 +23,141 @@ QUEUE_LIBRARY_API typedef struct node {
     struct node* next;
 } node_t;
 
+/**
+ * Nodes are carved out of large slabs instead of being malloc'd one by one.
+ * Every slab is aligned to its own size so the owning slab of a node is found
+ * by masking the node address. Freed nodes are kept on an intrusive free list
+ * inside their slab and a slab is returned once all of its nodes are free.
+ * The slabs are shared by every queue, so many sparse queues fill the same
+ * slabs rather than holding one mostly empty slab each. All entry points run
+ * with the GIL held, which also guards the shared lists.
+ */
+#define SLAB_SIZE (64 * 1024)
+
+typedef struct slab {
+    struct slab* prev; // Neighbours in the queue's list of slabs with room
+    struct slab* next;
+    node_t* free_list; // Nodes released back to this slab
+    unsigned int used; // Number of nodes currently handed out
+    unsigned int bump; // Number of nodes ever carved from this slab
+} slab_t;
+
+#define SLAB_NODES ((SLAB_SIZE - sizeof(slab_t)) / sizeof(node_t))
+
 QUEUE_LIBRARY_API typedef struct queue {
     node_t* front;
     node_t* back;
     unsigned int length;
 } queue_t;
 
-node_t* new_node(PyObject* object) {
-    node_t* node = (node_t*)malloc(sizeof(node_t));
-    if (node == NULL)
+static slab_t* partial_slabs; // Slabs that still have free nodes
+static slab_t* spare_slab;    // One empty slab kept around to avoid thrashing
+
+static inline slab_t* slab_of(node_t* node) {
+    return (slab_t*)((uintptr_t)node & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static inline node_t* slab_nodes(slab_t* slab) { return (node_t*)(slab + 1); }
+
+static slab_t* slab_alloc() {
+    void* memory;
+#ifdef _WIN32
+    memory = _aligned_malloc(SLAB_SIZE, SLAB_SIZE);
+#else
+    if (posix_memalign(&memory, SLAB_SIZE, SLAB_SIZE) != 0)
+        memory = NULL;
+#endif
+    if (memory == NULL)
         return NULL;
 
+    slab_t* slab = (slab_t*)memory;
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->free_list = NULL;
+    slab->used = 0;
+    slab->bump = 0;
+    return slab;
+}
+
+static void slab_free(slab_t* slab) {
+#ifdef _WIN32
+    _aligned_free(slab);
+#else
+    free(slab);
+#endif
+}
+
+static inline void slab_unlink(slab_t* slab) {
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        partial_slabs = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static inline void slab_push(slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = partial_slabs;
+    if (partial_slabs != NULL)
+        partial_slabs->prev = slab;
+    partial_slabs = slab;
+}
+
+node_t* new_node(PyObject* object) {
+    slab_t* slab = partial_slabs;
+    if (slab == NULL) {
+        if (spare_slab != NULL) {
+            slab = spare_slab;
+            spare_slab = NULL;
+        } else {
+            slab = slab_alloc();
+            if (slab == NULL)
+                return NULL;
+        }
+        slab_push(slab);
+    }
+
+    node_t* node;
+    if (slab->free_list != NULL) {
+        node = slab->free_list;
+        slab->free_list = node->next;
+    } else {
+        node = slab_nodes(slab) + slab->bump++;
+    }
+
+    if (++slab->used == SLAB_NODES)
+        slab_unlink(slab);
+
     Py_INCREF(object);
     node->object = object;
     node->next = NULL;
     return node;
 }
 
+void release_node(node_t* node) {
+    slab_t* slab = slab_of(node);
+    if (slab->used-- == SLAB_NODES)
+        slab_push(slab);
+
+    if (slab->used == 0) {
+        slab_unlink(slab);
+        if (spare_slab == NULL) {
+            slab->free_list = NULL;
+            slab->bump = 0;
+            spare_slab = slab;
+        } else {
+            slab_free(slab);
+        }
+        return;
+    }
+
+    node->next = slab->free_list;
+    slab->free_list = node;
+}
+
 QUEUE_LIBRARY_API queue_t* new_node_queue() {
     queue_t* queue = (queue_t*)malloc(sizeof(queue_t));
     queue->front = NULL;
@@ -51,11 +174,11 @@ QUEUE_LIBRARY_API int is_empty(queue_t* queue) {
     return queue->length == 0;
 }
 
-QUEUE_LIBRARY_API void enqueue(queue_t* queue, PyObject* object) {
-    if (object == Py_None)
-        return;
-
+static inline int push_node(queue_t* queue, PyObject* object) {
     node_t* node = new_node(object);
+    if (node == NULL)
+        return -1;
+
     if (queue->back == NULL) {
         queue->front = node;
         queue->back = node;
@@ -64,22 +187,72 @@ QUEUE_LIBRARY_API void enqueue(queue_t* queue, PyObject* object) {
         queue->back = node;
     }
     queue->length++;
+    return 0;
 }
 
-QUEUE_LIBRARY_API PyObject* dequeue(queue_t* queue) {
-    if (is_empty(queue))
-        return NULL;
-
+static inline PyObject* pop_node(queue_t* queue) {
     node_t* temp = queue->front;
     PyObject* object = temp->object;
     queue->front = temp->next;
-    free(temp);
+    release_node(temp);
     if (queue->front == NULL)
         queue->back = NULL;
     queue->length--;
     return object;
 }
 
+QUEUE_LIBRARY_API void enqueue(queue_t* queue, PyObject* object) {
+    if (object == Py_None)
+        return;
+
+    if (push_node(queue, object) < 0)
+        PyErr_NoMemory();
+}
+
+QUEUE_LIBRARY_API PyObject* dequeue(queue_t* queue) {
+    if (is_empty(queue))
+        return NULL;
+
+    return pop_node(queue);
+}
+
+// Enqueue every item of an iterable, returns the number of items added
+QUEUE_LIBRARY_API Py_ssize_t enqueue_many(queue_t* queue, PyObject* items) {
+    PyObject* seq = PySequence_Fast(items, "enqueue_many expects an iterable");
+    if (seq == NULL)
+        return -1;
+
+    Py_ssize_t len = PySequence_Fast_GET_SIZE(seq);
+    PyObject** objects = PySequence_Fast_ITEMS(seq);
+    Py_ssize_t added = 0;
+    for (Py_ssize_t i = 0; i < len; ++i) {
+        if (objects[i] == Py_None)
+            continue;
+        if (push_node(queue, objects[i]) < 0) {
+            Py_DECREF(seq);
+            PyErr_NoMemory();
+            return -1;
+        }
+        added++;
+    }
+    Py_DECREF(seq);
+    return added;
+}
+
+// Dequeue up to count items and append them to out, returns the number moved
+QUEUE_LIBRARY_API Py_ssize_t dequeue_many(queue_t* queue, PyObject* out,
+                                          Py_ssize_t count) {
+    Py_ssize_t moved = 0;
+    while (moved < count && queue->length > 0) {
+        // Appended before the node is unlinked so a failure loses nothing
+        if (PyList_Append(out, queue->front->object) < 0)
+            return -1;
+        Py_DECREF(pop_node(queue));
+        moved++;
+    }
+    return moved;
+}
+
 QUEUE_LIBRARY_API void free_q(queue_t* queue) {
     if (queue == NULL) {
         perror("Queue not allocated");
@@ -91,7 +264,7 @@ QUEUE_LIBRARY_API void free_q(queue_t* queue) {
     while (current != NULL) {
         next = current->next;
         Py_DECREF(current->object);
-        free(current);
+        release_node(current);
         current = next;
     }
     free(queue);
@@ -3,16 +3,524 @@
  */
 #include <Python.h>
 #include <pythread.h>
+#include <structmember.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 #define CHUNKLEN 256
 #define CHUNKEND (CHUNKLEN - 1)
 
+// Queue chunks start small and double in size up to a per instance cap
+#define CHUNKMIN 8
+#define CHUNKMAX (1 << 20)
+
+// Chunks of at least CHUNK_ALIGN_MIN slots start their items on a cache line,
+// smaller ones live in pymalloc pools and only span a few lines anyway
+#define CACHE_LINE 64
+#define CHUNK_ALIGN_MIN 64
+
+// Scans start loading the item PREFETCH_DISTANCE slots ahead of the one they
+// look at, so walking a large queue waits on bandwidth rather than latency
+#define PREFETCH_DISTANCE 8
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#else
+#define PREFETCH(addr) ((void)0)
+#endif
+
+#if PY_VERSION_HEX >= 0x03090000
+#define GC_IS_TRACKED(op) PyObject_GC_IsTracked((PyObject*)(op))
+#else
+#define GC_IS_TRACKED(op) _PyObject_GC_IS_TRACKED(op)
+#endif
+
+// Whether an item counts towards gcEntries. The answer must not change while
+// the item is held, so tuples count even once the collector untracks them:
+// it does so lazily, after the tuple may already have been counted.
+#define GC_MAY_BE_TRACKED(op) PyObject_IS_GC(op)
+
+/**
+ * Queues holding only atomic items like int, str and bytes cannot be part of
+ * a cycle. They keep count of their GC tracked items and stay out of the
+ * collector while that count is zero, like CPython does for tuples and dicts.
+ */
+static inline void GC_item_added(PyObject* container, Py_ssize_t* gcEntries,
+                                 PyObject* item) {
+    if (GC_MAY_BE_TRACKED(item) && (*gcEntries)++ == 0 &&
+        !GC_IS_TRACKED(container)) {
+        PyObject_GC_Track(container);
+    }
+}
+
+static inline void GC_item_removed(PyObject* container, Py_ssize_t* gcEntries,
+                                   PyObject* item) {
+    if (GC_MAY_BE_TRACKED(item) && --(*gcEntries) == 0) {
+        PyObject_GC_UnTrack(container);
+    }
+}
+
 PyDoc_STRVAR(is_empty_doc, "Returns whether the Queue is empty.");
 PyDoc_STRVAR(copy_doc, "Return a shallow copy of the Queue.");
 PyDoc_STRVAR(enqueue_doc, "Add an item to the front of the Queue.");
 PyDoc_STRVAR(dequeue_doc,
              "Remove and return an item from the end of the Queue.");
 PyDoc_STRVAR(extend_doc, "Enqueue a sequence of elements from an iterator.");
+PyDoc_STRVAR(splice_doc,
+             "Move every element of another Queue onto the front of the Queue, "
+             "leaving the other Queue empty.");
+PyDoc_STRVAR(snapshot_doc, "Return a list of the items in the Queue.");
+PyDoc_STRVAR(sizeof_doc, "Return the size of the Queue in memory, in bytes.");
+PyDoc_STRVAR(memory_usage_doc,
+             "Return a dict splitting the size of the Queue into the bytes "
+             "'used' to hold items and the 'spare' bytes of free slots.");
+
+typedef struct ChunkArena ChunkArena_t;
+
+/**
+ * Item storage shared between copies of a Queue. A chunk owns one reference
+ * to each item in [back, back + numEntries) and is only written to while a
+ * single queue refers to it, copies share it until one of them writes.
+ * While shared, the chunk is reported to the collector through a proxy
+ * object every owner holds one reference to, so the items are visited once
+ * however many queues see them. Chunks first shared by a queue without GC
+ * tracked items hold none either and get no proxy.
+ */
+typedef struct QueueChunk {
+    Py_ssize_t refcnt;
+    Py_ssize_t capacity;
+    Py_ssize_t back;
+    Py_ssize_t numEntries;
+    void* memory;        // Allocation holding the chunk
+    ChunkArena_t* arena; // NULL unless carved from a huge page arena
+    PyObject* proxy;     // SharedChunk of a shared chunk, else NULL
+    // The bookkeeping gets a cache line of its own, the items start after it
+    char pad[CACHE_LINE - 4 * sizeof(Py_ssize_t) - 3 * sizeof(void*)];
+    PyObject* py_objects[1];
+} QueueChunk_t;
+
+#define QueueChunk_SIZE(capacity) \
+    (offsetof(QueueChunk_t, py_objects) + (capacity) * sizeof(PyObject*))
+
+/**
+ * Arena carving chunks of a single capacity out of huge page backed regions,
+ * for queues of tens of millions of items whose scans would otherwise miss
+ * the TLB on every chunk. Like the slabs of the linked list queue, a freed
+ * chunk goes on a free list inside its region and a region is given back
+ * once all of its chunks are free, keeping one spare. The arena lives as
+ * long as a queue or a chunk uses it.
+ */
+#define ARENA_REGION (2 * 1024 * 1024)
+
+typedef struct ArenaRegion {
+    struct ArenaRegion* prev; // Neighbours in the list of regions with room
+    struct ArenaRegion* next;
+    void* freeList;  // Chunks given back to this region
+    Py_ssize_t used; // Number of chunks currently handed out
+    Py_ssize_t bump; // Number of chunks ever carved from this region
+    size_t size;     // Bytes mapped
+    char pad[CACHE_LINE - 3 * sizeof(void*) - 2 * sizeof(Py_ssize_t) -
+             sizeof(size_t)];
+} ArenaRegion_t;
+
+struct ChunkArena {
+    Py_ssize_t refcnt;   // Queues using the arena and chunks carved from it
+    Py_ssize_t capacity; // Slots of every chunk carved
+    size_t chunkSize;    // Bytes per chunk, whole cache lines
+    size_t regionSize;
+    Py_ssize_t perRegion;   // Chunks per region
+    ArenaRegion_t* partial; // Regions with free chunks
+    ArenaRegion_t* spare;   // One empty region kept around
+};
+
+#ifndef _WIN32
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+static ArenaRegion_t* ArenaRegion_map(size_t size) {
+#ifdef _WIN32
+    char* start = (char*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+                                      PAGE_READWRITE);
+    if (start == NULL) {
+        return NULL;
+    }
+#else
+    // Map a region more than needed so the mapping can start on a huge page
+    size_t span = size + ARENA_REGION;
+    char* memory = (char*)mmap(NULL, span, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == (char*)MAP_FAILED) {
+        return NULL;
+    }
+    char* start = (char*)(((uintptr_t)memory + ARENA_REGION - 1) &
+                          ~(uintptr_t)(ARENA_REGION - 1));
+    if (start != memory) {
+        munmap(memory, start - memory);
+    }
+    if (start + size != memory + span) {
+        munmap(start + size, memory + span - (start + size));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(start, size, MADV_HUGEPAGE);
+#endif
+#endif
+    ArenaRegion_t* region = (ArenaRegion_t*)start;
+    region->prev = NULL;
+    region->next = NULL;
+    region->freeList = NULL;
+    region->used = 0;
+    region->bump = 0;
+    region->size = size;
+    return region;
+}
+
+static void ArenaRegion_unmap(ArenaRegion_t* region) {
+#ifdef _WIN32
+    VirtualFree(region, 0, MEM_RELEASE);
+#else
+    munmap(region, region->size);
+#endif
+}
+
+static inline void ChunkArena_unlink(ChunkArena_t* arena,
+                                     ArenaRegion_t* region) {
+    if (region->prev != NULL) {
+        region->prev->next = region->next;
+    } else {
+        arena->partial = region->next;
+    }
+    if (region->next != NULL) {
+        region->next->prev = region->prev;
+    }
+    region->prev = NULL;
+    region->next = NULL;
+}
+
+static inline void ChunkArena_push(ChunkArena_t* arena,
+                                   ArenaRegion_t* region) {
+    region->prev = NULL;
+    region->next = arena->partial;
+    if (arena->partial != NULL) {
+        arena->partial->prev = region;
+    }
+    arena->partial = region;
+}
+
+static ChunkArena_t* ChunkArena_new(Py_ssize_t capacity) {
+    ChunkArena_t* arena = (ChunkArena_t*)PyMem_Malloc(sizeof(ChunkArena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->refcnt = 1;
+    arena->capacity = capacity;
+    arena->chunkSize = (QueueChunk_SIZE(capacity) + CACHE_LINE - 1) &
+                       ~(size_t)(CACHE_LINE - 1);
+    arena->regionSize = ARENA_REGION;
+    while (arena->regionSize < sizeof(ArenaRegion_t) + arena->chunkSize) {
+        arena->regionSize += ARENA_REGION;
+    }
+    arena->perRegion =
+        (arena->regionSize - sizeof(ArenaRegion_t)) / arena->chunkSize;
+    arena->partial = NULL;
+    arena->spare = NULL;
+    return arena;
+}
+
+static void ChunkArena_decref(ChunkArena_t* arena) {
+    if (--arena->refcnt > 0) {
+        return;
+    }
+    // Every chunk was given back, only empty regions are left
+    while (arena->partial != NULL) {
+        ArenaRegion_t* region = arena->partial;
+        arena->partial = region->next;
+        ArenaRegion_unmap(region);
+    }
+    if (arena->spare != NULL) {
+        ArenaRegion_unmap(arena->spare);
+    }
+    PyMem_Free(arena);
+}
+
+static QueueChunk_t* ChunkArena_alloc(ChunkArena_t* arena) {
+    ArenaRegion_t* region = arena->partial;
+    if (region == NULL) {
+        if (arena->spare != NULL) {
+            region = arena->spare;
+            arena->spare = NULL;
+        } else {
+            region = ArenaRegion_map(arena->regionSize);
+            if (region == NULL) {
+                return NULL;
+            }
+        }
+        ChunkArena_push(arena, region);
+    }
+
+    QueueChunk_t* chunk;
+    if (region->freeList != NULL) {
+        chunk = (QueueChunk_t*)region->freeList;
+        region->freeList = *(void**)chunk;
+    } else {
+        chunk = (QueueChunk_t*)((char*)(region + 1) +
+                                region->bump++ * arena->chunkSize);
+    }
+    if (++region->used == arena->perRegion) {
+        ChunkArena_unlink(arena, region);
+    }
+    chunk->memory = region;
+    chunk->arena = arena;
+    arena->refcnt++;
+    return chunk;
+}
+
+static void ChunkArena_free(QueueChunk_t* chunk) {
+    ChunkArena_t* arena = chunk->arena;
+    ArenaRegion_t* region = (ArenaRegion_t*)chunk->memory;
+    if (region->used-- == arena->perRegion) {
+        ChunkArena_push(arena, region);
+    }
+
+    if (region->used == 0) {
+        ChunkArena_unlink(arena, region);
+        if (arena->spare == NULL) {
+            region->freeList = NULL;
+            region->bump = 0;
+            arena->spare = region;
+        } else {
+            ArenaRegion_unmap(region);
+        }
+    } else {
+        *(void**)chunk = region->freeList;
+        region->freeList = chunk;
+    }
+    ChunkArena_decref(arena);
+}
+
+// Allocate a chunk, from the arena when it carves chunks of this capacity
+static QueueChunk_t* QueueChunk_alloc(ChunkArena_t* arena,
+                                      Py_ssize_t capacity) {
+    QueueChunk_t* chunk;
+    if (arena != NULL && capacity == arena->capacity) {
+        chunk = ChunkArena_alloc(arena);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    } else {
+        size_t slack = capacity < CHUNK_ALIGN_MIN ? 0 : CACHE_LINE - 1;
+        void* memory = PyMem_Malloc(QueueChunk_SIZE(capacity) + slack);
+        if (memory == NULL) {
+            return NULL;
+        }
+        chunk = (QueueChunk_t*)(((uintptr_t)memory + slack) &
+                                ~(uintptr_t)(slack ? CACHE_LINE - 1 : 0));
+        chunk->memory = memory;
+        chunk->arena = NULL;
+    }
+    chunk->refcnt = 1;
+    chunk->capacity = capacity;
+    chunk->back = 0;
+    chunk->numEntries = 0;
+    chunk->proxy = NULL;
+    return chunk;
+}
+
+static inline QueueChunk_t* QueueChunk_new(Py_ssize_t capacity) {
+    return QueueChunk_alloc(NULL, capacity);
+}
+
+// Release the oldest item owned by the chunk
+static inline void QueueChunk_pop(QueueChunk_t* chunk) {
+    PyObject* py_object = chunk->py_objects[chunk->back];
+    if (++chunk->back == chunk->capacity) {
+        chunk->back = 0;
+    }
+    chunk->numEntries--;
+    Py_DECREF(py_object);
+}
+
+/**
+ * Split the items of a chunk into the run from back up to the end of the
+ * storage and the run wrapped around to its start, so scans index both
+ * directly instead of reducing every index. Queue chunks are powers of two
+ * but QueueC rings are not, this serves both.
+ */
+static inline Py_ssize_t QueueChunk_runs(QueueChunk_t* chunk,
+                                         Py_ssize_t* wrapped) {
+    Py_ssize_t end = chunk->back + chunk->numEntries;
+    if (end > chunk->capacity) {
+        *wrapped = end - chunk->capacity;
+        return chunk->capacity;
+    }
+    *wrapped = 0;
+    return end;
+}
+
+// Drop one reference to the chunk, its items are released once it is unused
+static void QueueChunk_decref(QueueChunk_t* chunk) {
+    if (--chunk->refcnt > 0) {
+        PyObject* proxy = chunk->proxy;
+        if (proxy != NULL) {
+            if (chunk->refcnt == 1) {
+                // The last owner reports the items itself again
+                chunk->proxy = NULL;
+                Py_DECREF(proxy);
+            }
+            Py_DECREF(proxy);
+        }
+        return;
+    }
+    // Nothing reaches the chunk any more, destructors cannot see it half freed
+    PyObject** items = chunk->py_objects;
+    Py_ssize_t wrapped;
+    Py_ssize_t end = QueueChunk_runs(chunk, &wrapped);
+    for (Py_ssize_t i = chunk->back; i < end; ++i) {
+        if (i + PREFETCH_DISTANCE < end) {
+            PREFETCH(items[i + PREFETCH_DISTANCE]);
+        }
+        Py_DECREF(items[i]);
+    }
+    for (Py_ssize_t i = 0; i < wrapped; ++i) {
+        if (i + PREFETCH_DISTANCE < wrapped) {
+            PREFETCH(items[i + PREFETCH_DISTANCE]);
+        }
+        Py_DECREF(items[i]);
+    }
+    if (chunk->arena != NULL) {
+        ChunkArena_free(chunk);
+    } else {
+        PyMem_Free(chunk->memory);
+    }
+}
+
+static int QueueChunk_visit_items(QueueChunk_t* chunk, visitproc visit,
+                                  void* arg) {
+    PyObject** items = chunk->py_objects;
+    Py_ssize_t wrapped;
+    Py_ssize_t end = QueueChunk_runs(chunk, &wrapped);
+    for (Py_ssize_t i = chunk->back; i < end; ++i) {
+        if (i + PREFETCH_DISTANCE < end) {
+            PREFETCH(items[i + PREFETCH_DISTANCE]);
+        }
+        Py_VISIT(items[i]);
+    }
+    for (Py_ssize_t i = 0; i < wrapped; ++i) {
+        if (i + PREFETCH_DISTANCE < wrapped) {
+            PREFETCH(items[i + PREFETCH_DISTANCE]);
+        }
+        Py_VISIT(items[i]);
+    }
+    return 0;
+}
+
+static int QueueChunk_traverse(QueueChunk_t* chunk, visitproc visit,
+                               void* arg) {
+    Py_VISIT(chunk->proxy);
+    if (chunk->refcnt > 1) {
+        return 0;
+    }
+    return QueueChunk_visit_items(chunk, visit, arg);
+}
+
+/**
+ * Collector view of a shared chunk. It holds no reference of its own, its
+ * refcount mirrors the number of owners and it dies with the last but one.
+ * Owners break cycles through it by releasing the chunk in their tp_clear.
+ */
+typedef struct SharedChunk {
+    PyObject_HEAD QueueChunk_t* chunk;
+} SharedChunk_t;
+
+static void SharedChunk_dealloc(SharedChunk_t* self) {
+    PyObject_GC_UnTrack(self);
+    PyObject_GC_Del(self);
+}
+
+static int SharedChunk_traverse(SharedChunk_t* self, visitproc visit,
+                                void* arg) {
+    return QueueChunk_visit_items(self->chunk, visit, arg);
+}
+
+static PyTypeObject SharedChunkType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "SharedChunk", /* tp_name */
+    sizeof(SharedChunk_t),                        /* tp_basicsize */
+    0,                                            /* tp_itemsize */
+    (destructor)SharedChunk_dealloc,              /* tp_dealloc */
+    0,                                            /* tp_print */
+    0,                                            /* tp_getattr */
+    0,                                            /* tp_setattr */
+    0,                                            /* tp_reserved */
+    0,                                            /* tp_repr */
+    0,                                            /* tp_as_number */
+    0,                                            /* tp_as_sequence */
+    0,                                            /* tp_as_mapping */
+    PyObject_HashNotImplemented,                  /* tp_hash */
+    0,                                            /* tp_call */
+    0,                                            /* tp_str */
+    0,                                            /* tp_getattro */
+    0,                                            /* tp_setattro */
+    0,                                            /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,      /* tp_flags */
+    0,                                            /* tp_doc */
+    (traverseproc)SharedChunk_traverse,           /* tp_traverse */
+    0,                                            /* tp_clear */
+    0,                                            /* tp_richcompare */
+    0,                                            /* tp_weaklistoffset */
+    0,                                            /* tp_iter */
+    0,                                            /* tp_iternext */
+    0,                                            /* tp_methods */
+    0,                                            /* tp_members */
+    0,                                            /* tp_getset */
+    0,                                            /* tp_base */
+    0,                                            /* tp_dict */
+    0,                                            /* tp_descr_get */
+    0,                                            /* tp_descr_set */
+    0,                                            /* tp_dictoffset */
+    0,                                            /* tp_init */
+    0,                                            /* tp_alloc */
+    0,                                            /* tp_new */
+    PyObject_GC_Del,                              /* tp_free */
+};
+
+// Add an owner to the chunk, gcEntries is the count of the queue sharing it
+static int QueueChunk_share(QueueChunk_t* chunk, Py_ssize_t gcEntries) {
+    if (chunk->refcnt > 1) {
+        // Shared items never change, the proxy exists if they need one
+        Py_XINCREF(chunk->proxy);
+    } else if (gcEntries > 0) {
+        SharedChunk_t* proxy = PyObject_GC_New(SharedChunk_t, &SharedChunkType);
+        if (proxy == NULL) {
+            return -1;
+        }
+        proxy->chunk = chunk;
+        PyObject_GC_Track(proxy);
+        chunk->proxy = (PyObject*)proxy;
+        Py_INCREF(proxy);
+    }
+    chunk->refcnt++;
+    return 0;
+}
+
+// Add the bytes of a chunk a queue holds numEntries items in, a chunk shared
+// by copies is split evenly between them so their sizes add up
+static inline void QueueChunk_memory(QueueChunk_t* chunk, Py_ssize_t numEntries,
+                                     Py_ssize_t* used, Py_ssize_t* spare) {
+    *used += QueueChunk_SIZE(numEntries) / chunk->refcnt;
+    *spare +=
+        (chunk->capacity - numEntries) * sizeof(PyObject*) / chunk->refcnt;
+}
+
+static PyObject* memory_usage_new(Py_ssize_t used, Py_ssize_t spare) {
+    return Py_BuildValue("{s:n,s:n}", "used", used, "spare", spare);
+}
 
 /**
  * Single ended Contiguous Python Queue
@@ -23,9 +531,15 @@ typedef struct {
     size_t capacity;
     size_t front;
     size_t back;
-    PyObject** objects;
+    PyObject** objects; // Alias of buffer->py_objects
+    QueueChunk_t* buffer;
+    Py_ssize_t gcEntries; // Number of held items tracked by the collector
+    Py_ssize_t maxlen;    // Bound on length, -1 when unbounded
+    Py_ssize_t dropped;   // Items evicted to stay within maxlen
 } QueueC;
 
+static PyTypeObject QueueCType;
+
 static PyObject* QueueC_is_empty(QueueC* self, PyObject* args) {
     if (self->length) {
         Py_RETURN_FALSE;
@@ -40,39 +554,48 @@ static PyObject* QueueC_new(PyTypeObject* type, PyObject* args,
         return PyErr_NoMemory();
     }
 
-    self->objects = (PyObject**)malloc(CHUNKLEN * sizeof(PyObject*));
-    if (self->objects == NULL) {
+    self->buffer = QueueChunk_new(CHUNKLEN);
+    if (self->buffer == NULL) {
         Py_DECREF(self);
         return PyErr_NoMemory();
     }
 
+    self->objects = self->buffer->py_objects;
     self->length = 0;
     self->back = 0;
     self->capacity = CHUNKLEN;
     self->front = CHUNKEND;
+    self->gcEntries = 0;
+    self->maxlen = -1;
+    self->dropped = 0;
+    PyObject_GC_UnTrack(self);
     return (PyObject*)self;
 }
 
+// The copy shares the buffer until either queue writes to it
 static PyObject* QueueC_copy(QueueC* self, PyObject* args) {
     QueueC* copy = (QueueC*)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
     if (copy == NULL) {
         return PyErr_NoMemory();
     }
 
-    copy->objects = (PyObject**)malloc(self->capacity * sizeof(PyObject*));
-    if (copy->objects == NULL) {
+    if (QueueChunk_share(self->buffer, self->gcEntries) < 0) {
+        copy->buffer = NULL;
         Py_DECREF(copy);
-        return PyErr_NoMemory();
-    }
-    for (size_t i = 0; i < self->length; ++i) {
-        size_t index = (self->back + i) % self->capacity;
-        copy->objects[index] = self->objects[index];
-        Py_INCREF(copy->objects[index]);
+        return NULL;
     }
+    copy->buffer = self->buffer;
+    copy->objects = self->objects;
     copy->length = self->length;
     copy->capacity = self->capacity;
     copy->front = self->front;
     copy->back = self->back;
+    copy->gcEntries = self->gcEntries;
+    copy->maxlen = self->maxlen;
+    copy->dropped = self->dropped;
+    if (copy->gcEntries == 0) {
+        PyObject_GC_UnTrack(copy);
+    }
     return (PyObject*)copy;
 }
 
@@ -81,61 +604,145 @@ static void QueueC_dealloc(QueueC* self) {
         return;
     }
     PyObject_GC_UnTrack(self);
-    free(self->objects);
+    if (self->buffer != NULL) {
+        QueueChunk_decref(self->buffer);
+    }
     Py_TYPE(self)->tp_free(self);
 }
 
-static int QueueC_clear(QueueC* self) {
-    if (self->length == 0) {
+// Whether the buffer belongs to this queue alone and holds nothing else
+static inline int QueueC_writable(QueueC* self) {
+    return self->buffer->refcnt == 1 &&
+           self->buffer->numEntries == (Py_ssize_t)self->length;
+}
+
+// Make the buffer writable, copying it if it is shared with a copy
+static int QueueC_unshare(QueueC* self) {
+    QueueChunk_t* buffer = self->buffer;
+    if (buffer->refcnt == 1) {
+        // Items only a dropped copy still had
+        while (buffer->numEntries > (Py_ssize_t)self->length) {
+            QueueChunk_pop(buffer);
+        }
         return 0;
     }
 
+    QueueChunk_t* newBuffer = QueueChunk_new(self->capacity);
+    if (newBuffer == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
     for (size_t i = 0; i < self->length; ++i) {
         size_t index = (self->back + i) % self->capacity;
-        if (!PyObject_IS_GC(self->objects[index])) {
-            Py_DECREF(self->objects[index]);
+        if (i + PREFETCH_DISTANCE < self->length) {
+            PREFETCH(self->objects[(index + PREFETCH_DISTANCE) %
+                                   self->capacity]);
         }
+        newBuffer->py_objects[index] = self->objects[index];
+        Py_INCREF(self->objects[index]);
     }
-    self->length = 0;
-    self->front = self->capacity - 1;
-    self->back = 0;
+    newBuffer->back = self->back;
+    newBuffer->numEntries = self->length;
+    QueueChunk_decref(buffer);
+    self->buffer = newBuffer;
+    self->objects = newBuffer->py_objects;
     return 0;
 }
 
-static int QueueC_traverse(QueueC* self, visitproc visit, void* arg) {
-    for (size_t i = 0; i < self->length; ++i) {
-        size_t index = (self->back + i) % self->capacity;
-        Py_VISIT(self->objects[index]);
+// Empty the queue at the end of its buffer, items written later have to line
+// up with the ones the buffer still holds for a copy
+static inline void QueueC_reset(QueueC* self) {
+    self->length = 0;
+    self->gcEntries = 0;
+    self->back = (self->buffer->back + self->buffer->numEntries) %
+                 self->capacity;
+    self->front = (self->back + self->capacity - 1) % self->capacity;
+}
+
+static int QueueC_clear(QueueC* self) {
+    if (self->buffer->refcnt == 1) {
+        while (self->buffer->numEntries > 0) {
+            QueueChunk_pop(self->buffer);
+        }
+    } else {
+        // Let go of a shared buffer so cycles through copies are broken,
+        // out of memory the queue only empties its view of it
+        QueueChunk_t* newBuffer = QueueChunk_new(CHUNKLEN);
+        if (newBuffer != NULL) {
+            QueueChunk_decref(self->buffer);
+            self->buffer = newBuffer;
+            self->objects = newBuffer->py_objects;
+            self->capacity = CHUNKLEN;
+        }
     }
+    QueueC_reset(self);
     return 0;
 }
 
-static void QueueC_resize(QueueC* self, size_t newCapacity) {
-    PyObject** newObjects = (PyObject**)malloc(newCapacity * sizeof(PyObject*));
-    if (newObjects == NULL) {
+static int QueueC_traverse(QueueC* self, visitproc visit, void* arg) {
+    return QueueChunk_traverse(self->buffer, visit, arg);
+}
+
+static void QueueC_memory(QueueC* self, Py_ssize_t* used, Py_ssize_t* spare) {
+    *used += Py_TYPE(self)->tp_basicsize;
+    QueueChunk_memory(self->buffer, self->length, used, spare);
+}
+
+static PyObject* QueueC_sizeof(QueueC* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    QueueC_memory(self, &used, &spare);
+    return PyLong_FromSsize_t(used + spare);
+}
+
+static PyObject* QueueC_memory_usage(QueueC* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    QueueC_memory(self, &used, &spare);
+    return memory_usage_new(used, spare);
+}
+
+static int QueueC_resize(QueueC* self, size_t newCapacity) {
+    QueueChunk_t* newBuffer = QueueChunk_new(newCapacity);
+    if (newBuffer == NULL) {
         PyErr_NoMemory();
-        return;
+        return -1;
     }
+
+    PyObject** newObjects = newBuffer->py_objects;
     for (size_t i = 0; i < self->length; ++i) {
         newObjects[i] = self->objects[(self->back + i) % self->capacity];
     }
+    if (QueueC_writable(self)) {
+        // The references move along with the items
+        self->buffer->numEntries = 0;
+    } else {
+        for (size_t i = 0; i < self->length; ++i) {
+            Py_INCREF(newObjects[i]);
+        }
+    }
+    QueueChunk_decref(self->buffer);
+
+    newBuffer->numEntries = self->length;
     self->front = self->length - 1;
     self->back = 0;
-    free(self->objects);
+    self->buffer = newBuffer;
     self->objects = newObjects;
     self->capacity = newCapacity;
+    return 0;
 }
 
-static PyObject* QueueC_enqueue(QueueC* self, PyObject* object) {
-    if (self->length == self->capacity) {
-        QueueC_resize(self, self->capacity * 2);
+// Make room for count more items in a writable buffer
+static inline int QueueC_reserve(QueueC* self, size_t count) {
+    if (self->length + count > self->capacity) {
+        size_t newCapacity = self->capacity * 2;
+        if (newCapacity < self->length + count) {
+            newCapacity = (self->length + count) * 2;
+        }
+        return QueueC_resize(self, newCapacity);
     }
-
-    Py_INCREF(object);
-    self->front = (self->front + 1) % self->capacity;
-    self->objects[self->front] = object;
-    self->length++;
-    Py_RETURN_NONE;
+    if (!QueueC_writable(self)) {
+        return QueueC_unshare(self);
+    }
+    return 0;
 }
 
 static PyObject* QueueC_dequeue(QueueC* self) {
@@ -145,12 +752,127 @@ static PyObject* QueueC_dequeue(QueueC* self) {
     }
 
     PyObject* object = self->objects[self->back];
+    if (QueueC_writable(self)) {
+        self->buffer->back = (self->back + 1) % self->capacity;
+        self->buffer->numEntries--;
+    } else {
+        // The shared buffer keeps its own reference
+        Py_INCREF(object);
+    }
     self->back = (self->back + 1) % self->capacity;
     self->length--;
+    GC_item_removed((PyObject*)self, &self->gcEntries, object);
     return object;
 }
 
+// Add a new reference to object to the front of the queue, a bounded queue
+// that is full drops its oldest item instead of growing
+static inline int QueueC_put(QueueC* self, PyObject* object) {
+    PyObject* evicted = NULL;
+    if ((Py_ssize_t)self->length == self->maxlen) {
+        evicted = QueueC_dequeue(self);
+        self->dropped++;
+    }
+    if (QueueC_reserve(self, 1) < 0) {
+        Py_XDECREF(evicted);
+        return -1;
+    }
+
+    Py_INCREF(object);
+    self->front = (self->front + 1) % self->capacity;
+    self->objects[self->front] = object;
+    self->length++;
+    self->buffer->numEntries++;
+    GC_item_added((PyObject*)self, &self->gcEntries, object);
+    // Released last, a destructor may use the queue
+    Py_XDECREF(evicted);
+    return 0;
+}
+
+static PyObject* QueueC_enqueue(QueueC* self, PyObject* object) {
+    if (QueueC_put(self, object) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// Copy borrowed references into a writable ring with room for them
+static void QueueC_copy_in(QueueC* self, PyObject** objects, size_t len) {
+    // At most two runs, the second one starts where the ring wraps around
+    size_t to = (self->front + 1) % self->capacity;
+    size_t run = self->capacity - to < len ? self->capacity - to : len;
+    memcpy(self->objects + to, objects, run * sizeof(PyObject*));
+    memcpy(self->objects, objects + run, (len - run) * sizeof(PyObject*));
+    for (size_t i = 0; i < len; ++i) {
+        Py_INCREF(objects[i]);
+        GC_item_added((PyObject*)self, &self->gcEntries, objects[i]);
+    }
+
+    self->front = (self->front + len) % self->capacity;
+    self->length += len;
+    self->buffer->numEntries += len;
+}
+
+// Copy a run of borrowed references onto the front of the queue
+static int QueueC_put_many(QueueC* self, PyObject** objects, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+    // A bounded queue only keeps the newest items, the evicted ones are
+    // released once no more borrowed references are read
+    PyObject** evicted = NULL;
+    size_t numEvicted = 0;
+    if (self->maxlen >= 0) {
+        if (len > (size_t)self->maxlen) {
+            self->dropped += len - self->maxlen;
+            objects += len - self->maxlen;
+            len = self->maxlen;
+        }
+        if (self->length + len > (size_t)self->maxlen) {
+            numEvicted = self->length + len - self->maxlen;
+            evicted =
+                (PyObject**)PyMem_Malloc(numEvicted * sizeof(PyObject*));
+            if (evicted == NULL) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            for (size_t i = 0; i < numEvicted; ++i) {
+                evicted[i] = QueueC_dequeue(self);
+            }
+            self->dropped += numEvicted;
+        }
+    }
+
+    int res = QueueC_reserve(self, len);
+    if (res == 0) {
+        QueueC_copy_in(self, objects, len);
+    }
+    for (size_t i = 0; i < numEvicted; ++i) {
+        Py_DECREF(evicted[i]);
+    }
+    PyMem_Free(evicted);
+    return res;
+}
+
 static PyObject* QueueC_extend(QueueC* self, PyObject* iterator) {
+    // Lists and tuples are copied straight out of their item arrays, the
+    // queue itself is snapshotted so it does not keep growing under us
+    if (PyList_CheckExact(iterator) || PyTuple_CheckExact(iterator) ||
+        iterator == (PyObject*)self) {
+        PyObject* seq = PySequence_Fast(iterator, "");
+        if (seq == NULL) {
+            return NULL;
+        }
+        int res = QueueC_put_many(self, PySequence_Fast_ITEMS(seq),
+                                  PySequence_Fast_GET_SIZE(seq));
+        Py_DECREF(seq);
+        if (res < 0) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
     PyObject* iterable = PyObject_GetIter(iterator);
     if (iterable == NULL) {
         PyErr_Format(PyExc_TypeError, "Expected 'Iterable', got '%s'",
@@ -158,47 +880,202 @@ static PyObject* QueueC_extend(QueueC* self, PyObject* iterator) {
         return NULL;
     }
 
-    PyObject* (*next)(PyObject*);
-    next = *Py_TYPE(iterable)->tp_iternext;
+    // Grow once up front when the iterable can tell how much it holds, the
+    // ring of a bounded queue is already as large as it gets
+    Py_ssize_t hint = self->maxlen < 0 ? PyObject_LengthHint(iterator, 0) : 0;
+    if (hint < 0 || (hint > 0 && QueueC_reserve(self, hint) < 0)) {
+        Py_DECREF(iterable);
+        return NULL;
+    }
 
-    // Small optimization sizing, amortized approach is still very good
-    size_t len = (size_t)PyObject_Size(iterator);
-    if (len > self->length) {
-        if (self->length + len > self->capacity) {
-            QueueC_resize(self, (self->capacity + len) * 2);
+    PyObject* (*next)(PyObject*) = *Py_TYPE(iterable)->tp_iternext;
+    PyObject* object;
+    while ((object = next(iterable)) != NULL) {
+        int res = QueueC_put(self, object);
+        Py_DECREF(object);
+        if (res < 0) {
+            Py_DECREF(iterable);
+            return NULL;
         }
+    }
+    Py_DECREF(iterable);
 
-        for (size_t i = 1; i <= len; ++i) {
-            self->objects[(self->front + i) % self->capacity] = next(iterable);
-        }
-        self->front = (self->front + len) % self->capacity;
-        self->length += len;
-    } else {
-        for (size_t i = 0; i < len; ++i) {
-            QueueC_enqueue(self, next(iterable));
+    // A NULL from tp_iternext is either exhaustion or an error
+    if (PyErr_Occurred()) {
+        if (!PyErr_ExceptionMatches(PyExc_StopIteration)) {
+            return NULL;
         }
+        PyErr_Clear();
     }
-
-    Py_DECREF(iterable);
     Py_RETURN_NONE;
 }
 
-static int QueueC_init(QueueC* self, PyObject* args, PyObject* kwargs) {
-    Py_ssize_t arglen = PyTuple_GET_SIZE(args);
-    if (arglen == 1) {
-        PyObject* iterable = PyTuple_GET_ITEM(args, 0);
-        PyObject* res = QueueC_extend(self, iterable);
-        if (res == NULL) {
-            return -1;
-        }
-        Py_DECREF(res);
-    } else if (arglen > 1) {
-        PyErr_Format(PyExc_TypeError,
-                     "QueueC() requires at most 1 argument (%d given)", arglen);
-        return -1;
+// Copy the items out into a new list with two memcpy runs
+static PyObject* QueueC_snapshot(QueueC* self, PyObject* args) {
+    PyObject* list = PyList_New(self->length);
+    if (list == NULL) {
+        return NULL;
     }
-    return 0;
-}
+
+    PyObject** items = PySequence_Fast_ITEMS(list);
+    size_t run = self->capacity - self->back;
+    if (run > self->length) {
+        run = self->length;
+    }
+    memcpy(items, self->objects + self->back, run * sizeof(PyObject*));
+    memcpy(items + run, self->objects,
+           (self->length - run) * sizeof(PyObject*));
+    for (size_t i = 0; i < self->length; ++i) {
+        Py_INCREF(items[i]);
+    }
+    return list;
+}
+
+static PyObject* QueueC_splice(QueueC* self, PyObject* other) {
+    if (!PyObject_TypeCheck(other, &QueueCType)) {
+        PyErr_Format(PyExc_TypeError, "Expected 'QueueC', got '%s'",
+                     Py_TYPE(other)->tp_name);
+        return NULL;
+    }
+    QueueC* source = (QueueC*)other;
+    if (source == self) {
+        PyErr_SetString(PyExc_ValueError, "cannot splice a Queue into itself");
+        return NULL;
+    }
+
+    size_t len = source->length;
+    if (len == 0) {
+        Py_RETURN_NONE;
+    }
+    if (self->maxlen >= 0) {
+        // A bounded queue keeps only the newest items, so they are copied
+        PyObject* items = QueueC_snapshot(source, NULL);
+        if (items == NULL) {
+            return NULL;
+        }
+        PyObject_GC_UnTrack(source);
+        QueueC_clear(source);
+        int res = QueueC_put_many(self, PySequence_Fast_ITEMS(items), len);
+        Py_DECREF(items);
+        if (res < 0) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+    if (QueueC_reserve(self, len) < 0) {
+        return NULL;
+    }
+
+    // The free space of self is made one contiguous run, relinearizing the
+    // ring when it wraps around, so the at most two runs of the source take
+    // at most two memcpy calls
+    size_t to = (self->front + 1) % self->capacity;
+    if (to + len > self->capacity) {
+        if (self->length == 0) {
+            self->back = self->buffer->back = 0;
+            self->front = self->capacity - 1;
+        } else if (QueueC_resize(self, self->capacity) < 0) {
+            return NULL;
+        }
+        to = self->length;
+    }
+    size_t from = source->back;
+    size_t first = source->capacity - from;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(self->objects + to, source->objects + from,
+           first * sizeof(PyObject*));
+    memcpy(self->objects + to + first, source->objects,
+           (len - first) * sizeof(PyObject*));
+
+    if (QueueC_writable(source)) {
+        // The references now belong to self
+        source->buffer->numEntries = 0;
+    } else {
+        for (size_t i = 0; i < len; ++i) {
+            Py_INCREF(self->objects[to + i]);
+        }
+    }
+    self->front = (self->front + len) % self->capacity;
+    self->length += len;
+    self->buffer->numEntries += len;
+    if (source->gcEntries > 0) {
+        if (!GC_IS_TRACKED(self)) {
+            PyObject_GC_Track(self);
+        }
+        self->gcEntries += source->gcEntries;
+        PyObject_GC_UnTrack(source);
+    }
+    QueueC_reset(source);
+    Py_RETURN_NONE;
+}
+
+static PyObject* QueueC_inplace_concat(QueueC* self, PyObject* other) {
+    PyObject* res;
+    if (PyObject_TypeCheck(other, &QueueCType) && other != (PyObject*)self) {
+        res = QueueC_splice(self, other);
+    } else {
+        res = QueueC_extend(self, other);
+    }
+    if (res == NULL) {
+        return NULL;
+    }
+    Py_DECREF(res);
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
+static int QueueC_init(QueueC* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"iterable", "maxlen", NULL};
+    PyObject* iterable = NULL;
+    PyObject* maxlenObj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$O:QueueC", kwlist,
+                                     &iterable, &maxlenObj)) {
+        return -1;
+    }
+
+    if (maxlenObj != Py_None) {
+        Py_ssize_t maxlen = PyLong_AsSsize_t(maxlenObj);
+        if (maxlen == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (maxlen < 1) {
+            PyErr_SetString(PyExc_ValueError, "maxlen must be positive");
+            return -1;
+        }
+        while ((Py_ssize_t)self->length > maxlen) {
+            Py_DECREF(QueueC_dequeue(self));
+        }
+
+        // The ring is allocated once, a full queue overwrites its oldest item
+        size_t capacity = CHUNKMIN;
+        while (capacity < (size_t)maxlen) {
+            capacity *= 2;
+        }
+        if (capacity != self->capacity &&
+            QueueC_resize(self, capacity) < 0) {
+            return -1;
+        }
+        self->maxlen = maxlen;
+    }
+
+    if (iterable != NULL) {
+        PyObject* res = QueueC_extend(self, iterable);
+        if (res == NULL) {
+            return -1;
+        }
+        Py_DECREF(res);
+    }
+    return 0;
+}
+
+static PyObject* QueueC_get_maxlen(QueueC* self, void* closure) {
+    if (self->maxlen < 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromSsize_t(self->maxlen);
+}
 
 static Py_ssize_t QueueC_len(QueueC* self) { return (Py_ssize_t)self->length; }
 
@@ -223,34 +1100,78 @@ static int QueueC_setitem(QueueC* self, Py_ssize_t index, PyObject* object) {
         PyErr_SetString(PyExc_IndexError, "Queue index out of range");
         return -1;
     }
+    if (!QueueC_writable(self) && QueueC_unshare(self) < 0) {
+        return -1;
+    }
 
     PyObject* oldObject = self->objects[(self->back + index) % self->capacity];
-    Py_DECREF(oldObject);
     Py_INCREF(object);
     self->objects[(self->back + index) % self->capacity] = object;
+    GC_item_added((PyObject*)self, &self->gcEntries, object);
+    GC_item_removed((PyObject*)self, &self->gcEntries, oldObject);
+    Py_DECREF(oldObject);
     return 0;
 }
 
+// End of the first run of items in the ring, the wrapped ones after it run
+// from index 0 up to *wrapped
+static inline size_t QueueC_runs(QueueC* self, size_t* wrapped) {
+    size_t end = self->back + self->length;
+    if (end > self->capacity) {
+        *wrapped = end - self->capacity;
+        return self->capacity;
+    }
+    *wrapped = 0;
+    return end;
+}
+
 static int QueueC_contains(QueueC* self, PyObject* object) {
-    for (size_t i = 0; i < self->length; ++i) {
-        size_t index = (self->back + i) % self->capacity;
-        if (PyObject_RichCompareBool(object, self->objects[index], Py_EQ)) {
-            return 1;
+    // The items are scanned run by run, a comparison that changes the queue
+    // makes the scan carry on from the same position in the new layout
+    size_t i = 0;
+    while (i < self->length) {
+        PyObject** objects = self->objects;
+        size_t back = self->back;
+        size_t length = self->length;
+        size_t wrapped;
+        size_t end = QueueC_runs(self, &wrapped);
+        size_t index = back + i;
+        if (index >= end) {
+            index -= end;
+            end = wrapped;
+        }
+        for (; i < length; ++i, ++index) {
+            if (index == end) {
+                index = 0;
+                end = wrapped;
+            }
+            if (index + PREFETCH_DISTANCE < end) {
+                PREFETCH(objects[index + PREFETCH_DISTANCE]);
+            }
+            int cmp = PyObject_RichCompareBool(object, objects[index], Py_EQ);
+            if (cmp != 0) {
+                return cmp;
+            }
+            if (objects != self->objects || back != self->back ||
+                length != self->length) {
+                ++i;
+                break;
+            }
         }
     }
     return 0;
 }
 
 static PySequenceMethods QueueC_sequence_methods = {
-    (lenfunc)QueueC_len,             /* sq_length */
-    NULL,                            /* sq_concat */
-    NULL,                            /* sq_repeat */
-    (ssizeargfunc)QueueC_item,       /* sq_item */
-    NULL,                            /* sq_slice */
-    (ssizeobjargproc)QueueC_setitem, /* sq_as_item */
-    NULL,                            /* sq_as_slice */
-    (objobjproc)QueueC_contains,     /* sq_contains */
-    0                                /* sq_inplace_concat */
+    (lenfunc)QueueC_len,              /* sq_length */
+    NULL,                             /* sq_concat */
+    NULL,                             /* sq_repeat */
+    (ssizeargfunc)QueueC_item,        /* sq_item */
+    NULL,                             /* sq_slice */
+    (ssizeobjargproc)QueueC_setitem,  /* sq_as_item */
+    NULL,                             /* sq_as_slice */
+    (objobjproc)QueueC_contains,      /* sq_contains */
+    (binaryfunc)QueueC_inplace_concat /* sq_inplace_concat */
 };
 
 static PyMethodDef QueueC_methods[] = {
@@ -258,10 +1179,25 @@ static PyMethodDef QueueC_methods[] = {
     {"dequeue", (PyCFunction)QueueC_dequeue, METH_NOARGS, dequeue_doc},
     {"is_empty", (PyCFunction)QueueC_is_empty, METH_NOARGS, is_empty_doc},
     {"extend", (PyCFunction)QueueC_extend, METH_O, extend_doc},
+    {"splice", (PyCFunction)QueueC_splice, METH_O, splice_doc},
     {"__copy__", (PyCFunction)QueueC_copy, METH_NOARGS, copy_doc},
     {"copy", (PyCFunction)QueueC_copy, METH_NOARGS, copy_doc},
+    {"__sizeof__", (PyCFunction)QueueC_sizeof, METH_NOARGS, sizeof_doc},
+    {"memory_usage", (PyCFunction)QueueC_memory_usage, METH_NOARGS,
+     memory_usage_doc},
+    {"snapshot", (PyCFunction)QueueC_snapshot, METH_NOARGS, snapshot_doc},
     {NULL, NULL, 0, NULL}};
 
+static PyMemberDef QueueC_members[] = {
+    {"dropped", T_PYSSIZET, offsetof(QueueC, dropped), READONLY,
+     "Number of items evicted to stay within maxlen."},
+    {NULL}};
+
+static PyGetSetDef QueueC_getset[] = {
+    {"maxlen", (getter)QueueC_get_maxlen, NULL,
+     "Largest number of items held, None when unbounded.", NULL},
+    {NULL}};
+
 PyDoc_STRVAR(queuec_doc, "QueueC() -> Contiguous Single ended Queue object.");
 static PyTypeObject QueueCType = {
     PyVarObject_HEAD_INIT(NULL, 0) "QueueC", /* tp_name */
@@ -291,8 +1227,8 @@ static PyTypeObject QueueCType = {
     0,                                       /* tp_iter */
     0,                                       /* tp_iternext */
     QueueC_methods,                          /* tp_methods */
-    0,                                       /* tp_members */
-    0,                                       /* tp_getset */
+    QueueC_members,                          /* tp_members */
+    QueueC_getset,                           /* tp_getset */
     0,                                       /* tp_base */
     0,                                       /* tp_dict */
     0,                                       /* tp_descr_get */
@@ -312,16 +1248,22 @@ typedef struct QueueNode {
     Py_ssize_t numEntries; // Number of entries into the current node
     Py_ssize_t front;
     Py_ssize_t back;
+    Py_ssize_t mask; // Capacity of the chunk minus one
     struct QueueNode* next;
-    PyObject* py_objects[CHUNKLEN];
+    QueueChunk_t* chunk; // Storage, possibly shared with copies of the Queue
 } QueueNode_t;
 
 typedef struct Queue {
     PyObject_HEAD QueueNode_t* head;
     QueueNode_t* tail;
     Py_ssize_t length;
+    Py_ssize_t gcEntries; // Number of held items tracked by the collector
+    Py_ssize_t maxChunk;  // Largest chunk capacity, a power of two
+    ChunkArena_t* arena;  // Source of full size chunks, NULL for PyMem
 } Queue_t;
 
+static PyTypeObject QueueType;
+
 static PyObject* Queue_is_empty(Queue_t* self, PyObject* args) {
     if (self->length) {
         Py_RETURN_FALSE;
@@ -329,16 +1271,109 @@ static PyObject* Queue_is_empty(Queue_t* self, PyObject* args) {
     Py_RETURN_TRUE;
 }
 
-// Initialize a new QueueNode
-static inline QueueNode_t* QueueNode_new() {
-    QueueNode_t* node = (QueueNode_t*)malloc(sizeof(QueueNode_t));
+// Initialize a new QueueNode, capacity is a power of two
+static inline QueueNode_t* QueueNode_new(Py_ssize_t capacity,
+                                         ChunkArena_t* arena) {
+    QueueNode_t* node = (QueueNode_t*)PyMem_Malloc(sizeof(QueueNode_t));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->chunk = QueueChunk_alloc(arena, capacity);
+    if (node->chunk == NULL) {
+        PyMem_Free(node);
+        return NULL;
+    }
     node->numEntries = 0;
-    node->front = CHUNKEND;
+    node->mask = capacity - 1;
+    node->front = node->mask;
     node->back = 0;
     node->next = NULL;
     return node;
 }
 
+// Initialize a QueueNode viewing the same chunk as node
+static inline QueueNode_t* QueueNode_share(QueueNode_t* node,
+                                           Py_ssize_t gcEntries) {
+    QueueNode_t* copy = (QueueNode_t*)PyMem_Malloc(sizeof(QueueNode_t));
+    if (copy == NULL) {
+        return NULL;
+    }
+    if (QueueChunk_share(node->chunk, gcEntries) < 0) {
+        PyMem_Free(copy);
+        return NULL;
+    }
+    copy->chunk = node->chunk;
+    copy->numEntries = node->numEntries;
+    copy->mask = node->mask;
+    copy->front = node->front;
+    copy->back = node->back;
+    copy->next = NULL;
+    return copy;
+}
+
+static inline void QueueNode_free(QueueNode_t* node) {
+    QueueChunk_decref(node->chunk);
+    PyMem_Free(node);
+}
+
+// Start loading what a scan reads of the nodes after node. The next node was
+// itself requested one step earlier, so only the one after it is chased.
+static inline void QueueNode_prefetch_next(QueueNode_t* node) {
+    QueueNode_t* next = node->next;
+    if (next != NULL) {
+        PREFETCH(next->chunk);
+        PREFETCH(next->next);
+    }
+}
+
+static void QueueNode_free_all(QueueNode_t* node) {
+    QueueNode_t* next;
+    while (node != NULL) {
+        next = node->next;
+        QueueNode_prefetch_next(node);
+        QueueNode_free(node);
+        node = next;
+    }
+}
+
+// Whether the chunk belongs to this node alone and holds nothing else
+static inline int QueueNode_writable(QueueNode_t* node) {
+    return node->chunk->refcnt == 1 &&
+           node->chunk->numEntries == node->numEntries;
+}
+
+// Make the chunk of a node writable, copying it if it is shared
+static int QueueNode_unshare(QueueNode_t* node) {
+    QueueChunk_t* chunk = node->chunk;
+    if (chunk->refcnt == 1) {
+        // Items only a dropped copy still had
+        while (chunk->numEntries > node->numEntries) {
+            QueueChunk_pop(chunk);
+        }
+        return 0;
+    }
+
+    QueueChunk_t* newChunk = QueueChunk_alloc(chunk->arena, chunk->capacity);
+    if (newChunk == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < node->numEntries; ++i) {
+        Py_ssize_t index = (node->back + i) & node->mask;
+        if (i + PREFETCH_DISTANCE < node->numEntries) {
+            PREFETCH(chunk->py_objects[(index + PREFETCH_DISTANCE) &
+                                       node->mask]);
+        }
+        newChunk->py_objects[index] = chunk->py_objects[index];
+        Py_INCREF(chunk->py_objects[index]);
+    }
+    newChunk->back = node->back;
+    newChunk->numEntries = node->numEntries;
+    QueueChunk_decref(chunk);
+    node->chunk = newChunk;
+    return 0;
+}
+
 static PyObject* Queue_new(PyTypeObject* type, PyObject* args,
                            PyObject* kwargs) {
     Queue_t* self = (Queue_t*)type->tp_alloc(type, 0);
@@ -346,14 +1381,23 @@ static PyObject* Queue_new(PyTypeObject* type, PyObject* args,
         return PyErr_NoMemory();
     }
 
-    self->head = QueueNode_new();
+    self->arena = NULL;
+    self->head = QueueNode_new(CHUNKMIN, NULL);
+    if (self->head == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
     self->tail = self->head;
     self->length = 0;
+    self->gcEntries = 0;
+    self->maxChunk = CHUNKLEN;
+    PyObject_GC_UnTrack(self);
     return (PyObject*)self;
 }
 
+// The copy shares every chunk until either queue writes to it
 static PyObject* Queue_copy(Queue_t* self, PyObject* args) {
-    Queue_t* newQueue = (Queue_t*)Queue_new(Py_TYPE(self), args, NULL);
+    Queue_t* newQueue = (Queue_t*)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
     if (newQueue == NULL) {
         return PyErr_NoMemory();
     }
@@ -361,25 +1405,25 @@ static PyObject* Queue_copy(Queue_t* self, PyObject* args) {
     newQueue->head = NULL;
     newQueue->tail = NULL;
     newQueue->length = self->length;
+    newQueue->gcEntries = self->gcEntries;
+    newQueue->maxChunk = self->maxChunk;
+    newQueue->arena = self->arena;
+    if (newQueue->arena != NULL) {
+        newQueue->arena->refcnt++;
+    }
+    if (newQueue->gcEntries == 0) {
+        PyObject_GC_UnTrack(newQueue);
+    }
 
     QueueNode_t* current = self->head;
     while (current != NULL) {
-        QueueNode_t* newNode = QueueNode_new();
+        QueueNode_prefetch_next(current);
+        QueueNode_t* newNode = QueueNode_share(current, self->gcEntries);
         if (newNode == NULL) {
-            PyErr_NoMemory();
-            return NULL;
-        }
-
-        for (Py_ssize_t i = 0; i < current->numEntries; ++i) {
-            Py_ssize_t index = (current->back + i) & CHUNKEND;
-            newNode->py_objects[index] = current->py_objects[index];
-            Py_INCREF(current->py_objects[index]);
+            Py_DECREF(newQueue);
+            return PyErr_NoMemory();
         }
 
-        newNode->numEntries = current->numEntries;
-        newNode->front = current->front;
-        newNode->back = current->back;
-
         if (newQueue->head == NULL) {
             newQueue->head = newNode;
         } else {
@@ -391,24 +1435,116 @@ static PyObject* Queue_copy(Queue_t* self, PyObject* args) {
     return (PyObject*)newQueue;
 }
 
-// Add a py_object to the front of the QueueNode
+// Add a py_object to the front of a writable QueueNode
 static inline void QueueNode_put(QueueNode_t* queue_node, PyObject* py_object) {
-    queue_node->front = (queue_node->front + 1) & CHUNKEND;
-    queue_node->py_objects[queue_node->front] = py_object;
+    queue_node->front = (queue_node->front + 1) & queue_node->mask;
+    queue_node->chunk->py_objects[queue_node->front] = py_object;
     queue_node->numEntries++;
+    queue_node->chunk->numEntries++;
 }
 
-// Add a py_object to the last QueueNode in the Queue
-static PyObject* Queue_enqueue(Queue_t* self, PyObject* py_object) {
-    if (self->tail->numEntries == CHUNKLEN) {
-        QueueNode_t* node = QueueNode_new();
-        self->tail->next = node;
+// Capacity of a new chunk following one of the given capacity, doubled and
+// then grown further towards want items, up to max_chunk
+static inline Py_ssize_t Queue_next_capacity(Queue_t* self,
+                                             Py_ssize_t capacity,
+                                             Py_ssize_t want) {
+    capacity *= 2;
+    while (capacity < want && capacity < self->maxChunk) {
+        capacity *= 2;
+    }
+    return capacity < self->maxChunk ? capacity : self->maxChunk;
+}
+
+// Return the last QueueNode ready to take one more py_object, new chunks are
+// sized for the want items about to be written
+static inline QueueNode_t* Queue_writable_tail(Queue_t* self,
+                                               Py_ssize_t want) {
+    QueueNode_t* tail = self->tail;
+    if (self->length == 0 && tail->mask + 1 < want &&
+        tail->mask + 1 < self->maxChunk && QueueNode_writable(tail)) {
+        // An empty queue swaps its small first chunk for one that fits
+        QueueNode_t* node = QueueNode_new(
+            Queue_next_capacity(self, (tail->mask + 1) / 2, want),
+            self->arena);
+        if (node == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        QueueNode_free(tail);
+        self->head = node;
+        self->tail = node;
+        return node;
+    }
+    if (tail->numEntries > tail->mask) {
+        QueueNode_t* node = QueueNode_new(
+            Queue_next_capacity(self, tail->mask + 1, want), self->arena);
+        if (node == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        tail->next = node;
         self->tail = node;
+        return node;
+    }
+    if (!QueueNode_writable(tail) && QueueNode_unshare(tail) < 0) {
+        return NULL;
+    }
+    return tail;
+}
+
+// Add a new reference to py_object to the last QueueNode in the Queue
+static inline int Queue_put(Queue_t* self, PyObject* py_object) {
+    QueueNode_t* tail = Queue_writable_tail(self, 1);
+    if (tail == NULL) {
+        return -1;
     }
 
     Py_INCREF(py_object);
-    QueueNode_put(self->tail, py_object);
+    QueueNode_put(tail, py_object);
     self->length++;
+    GC_item_added((PyObject*)self, &self->gcEntries, py_object);
+    return 0;
+}
+
+// Copy a run of borrowed references into the tail chunks, one memcpy for
+// every contiguous stretch of free slots
+static int Queue_put_many(Queue_t* self, PyObject** py_objects,
+                          Py_ssize_t len) {
+    while (len > 0) {
+        QueueNode_t* tail = Queue_writable_tail(self, len);
+        if (tail == NULL) {
+            return -1;
+        }
+
+        Py_ssize_t start = (tail->front + 1) & tail->mask;
+        Py_ssize_t run = tail->mask + 1 - tail->numEntries;
+        if (run > tail->mask + 1 - start) {
+            run = tail->mask + 1 - start;
+        }
+        if (run > len) {
+            run = len;
+        }
+        memcpy(tail->chunk->py_objects + start, py_objects,
+               run * sizeof(PyObject*));
+        for (Py_ssize_t i = 0; i < run; ++i) {
+            Py_INCREF(py_objects[i]);
+            GC_item_added((PyObject*)self, &self->gcEntries, py_objects[i]);
+        }
+
+        tail->front = (start + run - 1) & tail->mask;
+        tail->numEntries += run;
+        tail->chunk->numEntries += run;
+        self->length += run;
+        py_objects += run;
+        len -= run;
+    }
+    return 0;
+}
+
+static PyObject* Queue_enqueue(Queue_t* self, PyObject* py_object) {
+    if (Queue_put(self, py_object) < 0) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -420,40 +1556,51 @@ static PyObject* Queue_dequeue(Queue_t* self) {
     }
 
     QueueNode_t* head = self->head;
-    PyObject* py_object = head->py_objects[head->back];
-    head->back = (head->back + 1) & CHUNKEND;
+    PyObject* py_object = head->chunk->py_objects[head->back];
+    if (QueueNode_writable(head)) {
+        head->chunk->back = (head->back + 1) & head->mask;
+        head->chunk->numEntries--;
+    } else {
+        // The shared chunk keeps its own reference
+        Py_INCREF(py_object);
+    }
+    head->back = (head->back + 1) & head->mask;
     head->numEntries--;
     self->length--;
+    GC_item_removed((PyObject*)self, &self->gcEntries, py_object);
 
     if (head->numEntries <= 0 && head->next != NULL) {
         self->head = head->next;
-        free(head);
+        QueueNode_free(head);
     }
 
     return py_object;
 }
 
 static int Queue_clear(Queue_t* self) {
-    if (self->length == 0) {
+    QueueNode_t* nodes = self->head;
+    if (nodes == NULL || (self->length == 0 && QueueNode_writable(nodes))) {
         return 0;
     }
 
-    QueueNode_t* current = self->head;
-    QueueNode_t* next;
-    while (current != NULL) {
-        for (Py_ssize_t i = 0; i < current->numEntries; ++i) {
-            Py_ssize_t index = (current->back + i) & CHUNKEND;
-            if (!PyObject_IS_GC(current->py_objects[index])) {
-                Py_DECREF(current->py_objects[index]);
-            }
-        }
-        next = current->next;
-        free(current);
-        current = next;
+    // Leave the Queue usable before any item is released
+    QueueNode_t* fresh = QueueNode_new(CHUNKMIN, NULL);
+    if (fresh == NULL) {
+        // Out of memory, the first node is kept as an empty view and its
+        // items are released on its next write like those of a dropped copy
+        fresh = nodes;
+        nodes = nodes->next;
+        fresh->next = NULL;
+        fresh->numEntries = 0;
+        fresh->back =
+            (fresh->chunk->back + fresh->chunk->numEntries) & fresh->mask;
+        fresh->front = (fresh->back - 1) & fresh->mask;
     }
+    self->head = fresh;
+    self->tail = fresh;
     self->length = 0;
-    self->head = NULL;
-    self->tail = NULL;
+    self->gcEntries = 0;
+    QueueNode_free_all(nodes);
     return 0;
 }
 
@@ -463,16 +1610,40 @@ static void Queue_dealloc(Queue_t* self) {
         return;
     }
     PyObject_GC_UnTrack(self);
-    Queue_clear(self);
+    QueueNode_free_all(self->head);
+    if (self->arena != NULL) {
+        ChunkArena_decref(self->arena);
+    }
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+static void Queue_memory(Queue_t* self, Py_ssize_t* used, Py_ssize_t* spare) {
+    *used += Py_TYPE(self)->tp_basicsize;
+    for (QueueNode_t* node = self->head; node != NULL; node = node->next) {
+        *used += sizeof(QueueNode_t);
+        QueueChunk_memory(node->chunk, node->numEntries, used, spare);
+    }
+}
+
+static PyObject* Queue_sizeof(Queue_t* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    Queue_memory(self, &used, &spare);
+    return PyLong_FromSsize_t(used + spare);
+}
+
+static PyObject* Queue_memory_usage(Queue_t* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    Queue_memory(self, &used, &spare);
+    return memory_usage_new(used, spare);
+}
+
 static int Queue_traverse(Queue_t* self, visitproc visit, void* arg) {
     QueueNode_t* current = self->head;
     while (current != NULL) {
-        for (Py_ssize_t i = 0; i < current->numEntries; ++i) {
-            Py_ssize_t index = (current->back + i) & CHUNKEND;
-            Py_VISIT(current->py_objects[index]);
+        QueueNode_prefetch_next(current);
+        int res = QueueChunk_traverse(current->chunk, visit, arg);
+        if (res) {
+            return res;
         }
         current = current->next;
     }
@@ -480,6 +1651,23 @@ static int Queue_traverse(Queue_t* self, visitproc visit, void* arg) {
 }
 
 static PyObject* Queue_extend(Queue_t* self, PyObject* iterator) {
+    // Lists and tuples are copied straight out of their item arrays, the
+    // queue itself is snapshotted so it does not keep growing under us
+    if (PyList_CheckExact(iterator) || PyTuple_CheckExact(iterator) ||
+        iterator == (PyObject*)self) {
+        PyObject* seq = PySequence_Fast(iterator, "");
+        if (seq == NULL) {
+            return NULL;
+        }
+        int res = Queue_put_many(self, PySequence_Fast_ITEMS(seq),
+                                 PySequence_Fast_GET_SIZE(seq));
+        Py_DECREF(seq);
+        if (res < 0) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
     PyObject* iterable = PyObject_GetIter(iterator);
     if (iterable == NULL) {
         PyErr_Format(PyExc_TypeError, "Expected 'Iterable', got '%s'",
@@ -487,58 +1675,198 @@ static PyObject* Queue_extend(Queue_t* self, PyObject* iterator) {
         return NULL;
     }
 
-    PyObject* (*next)(PyObject*);
-    next = *Py_TYPE(iterable)->tp_iternext;
-
-    Py_ssize_t len = PyObject_Size(iterator);
-    for (Py_ssize_t i = 0; i < len; ++i) {
-        if (self->tail->numEntries == CHUNKLEN) {
-            QueueNode_t* node = QueueNode_new();
-            self->tail->next = node;
-            self->tail = node;
+    // New chunks are sized from the length hint, up to max_chunk, and the
+    // items are written straight into the free slots of the tail. The
+    // iterator may run code that uses the queue, so the tail is checked
+    // again after every item and replaced once it is full or shared.
+    Py_ssize_t hint = PyObject_LengthHint(iterator, 0);
+    if (hint < 0) {
+        Py_DECREF(iterable);
+        return NULL;
+    }
+    PyObject* (*next)(PyObject*) = *Py_TYPE(iterable)->tp_iternext;
+    PyObject* py_object;
+    while ((py_object = next(iterable)) != NULL) {
+        QueueNode_t* tail = self->tail;
+        if (tail->numEntries > tail->mask || !QueueNode_writable(tail)) {
+            tail = Queue_writable_tail(self, hint > 1 ? hint : 1);
+            if (tail == NULL) {
+                Py_DECREF(py_object);
+                Py_DECREF(iterable);
+                return NULL;
+            }
         }
-        QueueNode_put(self->tail, next(iterable));
+        // The chunk takes over the reference next() returned
+        QueueNode_put(tail, py_object);
+        self->length++;
+        GC_item_added((PyObject*)self, &self->gcEntries, py_object);
+        hint--;
     }
-    self->length += len;
     Py_DECREF(iterable);
+
+    // A NULL from tp_iternext is either exhaustion or an error
+    if (PyErr_Occurred()) {
+        if (!PyErr_ExceptionMatches(PyExc_StopIteration)) {
+            return NULL;
+        }
+        PyErr_Clear();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Queue_splice(Queue_t* self, PyObject* other) {
+    if (!PyObject_TypeCheck(other, &QueueType)) {
+        PyErr_Format(PyExc_TypeError, "Expected 'Queue', got '%s'",
+                     Py_TYPE(other)->tp_name);
+        return NULL;
+    }
+    Queue_t* source = (Queue_t*)other;
+    if (source == self) {
+        PyErr_SetString(PyExc_ValueError, "cannot splice a Queue into itself");
+        return NULL;
+    }
+    if (source->length == 0) {
+        Py_RETURN_NONE;
+    }
+
+    // The source keeps a fresh empty node once its chunks are moved
+    QueueNode_t* fresh = QueueNode_new(CHUNKMIN, NULL);
+    if (fresh == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    QueueNode_t* head = source->head;
+    QueueNode_t* tail = self->tail;
+    if (self->length == 0) {
+        QueueNode_free(self->head);
+        self->head = head;
+        self->tail = source->tail;
+    } else if (head->numEntries <= tail->mask + 1 - tail->numEntries &&
+               (QueueNode_writable(tail) || QueueNode_unshare(tail) == 0)) {
+        // Fold a small leading chunk into our partially filled tail
+        int owned = QueueNode_writable(head);
+        for (Py_ssize_t i = 0; i < head->numEntries; ++i) {
+            PyObject* py_object =
+                head->chunk->py_objects[(head->back + i) & head->mask];
+            if (!owned) {
+                Py_INCREF(py_object);
+            }
+            QueueNode_put(tail, py_object);
+        }
+        if (owned) {
+            head->chunk->numEntries = 0;
+        }
+        if (head->next != NULL) {
+            tail->next = head->next;
+            self->tail = source->tail;
+        }
+        QueueNode_free(head);
+    } else {
+        PyErr_Clear();
+        tail->next = head;
+        self->tail = source->tail;
+    }
+
+    self->length += source->length;
+    if (source->gcEntries > 0) {
+        if (!GC_IS_TRACKED(self)) {
+            PyObject_GC_Track(self);
+        }
+        self->gcEntries += source->gcEntries;
+        source->gcEntries = 0;
+        PyObject_GC_UnTrack(source);
+    }
+    source->head = fresh;
+    source->tail = fresh;
+    source->length = 0;
     Py_RETURN_NONE;
 }
 
+static PyObject* Queue_inplace_concat(Queue_t* self, PyObject* other) {
+    PyObject* res;
+    if (PyObject_TypeCheck(other, &QueueType) && other != (PyObject*)self) {
+        res = Queue_splice(self, other);
+    } else {
+        res = Queue_extend(self, other);
+    }
+    if (res == NULL) {
+        return NULL;
+    }
+    Py_DECREF(res);
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
 static int Queue_init(Queue_t* self, PyObject* args, PyObject* kwargs) {
-    Py_ssize_t arglen = PyTuple_GET_SIZE(args);
-    if (arglen == 1) {
-        PyObject* iterable = PyTuple_GET_ITEM(args, 0);
+    static char* kwlist[] = {"iterable", "max_chunk", "huge_pages", NULL};
+    PyObject* iterable = NULL;
+    Py_ssize_t maxChunk = CHUNKLEN;
+    int hugePages = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$np:Queue", kwlist,
+                                     &iterable, &maxChunk, &hugePages)) {
+        return -1;
+    }
+    if (maxChunk < CHUNKMIN || maxChunk > CHUNKMAX) {
+        PyErr_Format(PyExc_ValueError, "max_chunk must be between %d and %d",
+                     CHUNKMIN, CHUNKMAX);
+        return -1;
+    }
+
+    // Round up to a power of two so chunk indices can be masked
+    self->maxChunk = CHUNKMIN;
+    while (self->maxChunk < maxChunk) {
+        self->maxChunk *= 2;
+    }
+
+    // Chunks already carved keep their arena alive until they are released
+    if (self->arena != NULL) {
+        ChunkArena_decref(self->arena);
+        self->arena = NULL;
+    }
+    if (hugePages) {
+        self->arena = ChunkArena_new(self->maxChunk);
+        if (self->arena == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    if (iterable != NULL) {
         PyObject* res = Queue_extend(self, iterable);
         if (res == NULL) {
             return -1;
         }
         Py_DECREF(res);
-    } else if (arglen > 1) {
-        PyErr_Format(PyExc_TypeError,
-                     "Queue() requires at most 1 argument (%d given)", arglen);
-        return -1;
     }
-
     return 0;
 }
 
 static Py_ssize_t Queue_len(Queue_t* self) { return self->length; }
 
+// Find the QueueNode holding the item at index, index becomes the offset of
+// the item inside that node. Nodes are not always full after a splice.
+static inline QueueNode_t* Queue_locate(Queue_t* self, Py_ssize_t* index) {
+    QueueNode_t* current = self->head;
+    while (*index >= current->numEntries) {
+        *index -= current->numEntries;
+        current = current->next;
+    }
+    return current;
+}
+
 static PyObject* Queue_item(Queue_t* self, Py_ssize_t index) {
     if (index < 0) {
         index += self->length;
     }
 
-    if (index >= self->length) {
+    if (index < 0 || index >= self->length) {
         PyErr_SetString(PyExc_IndexError, "Queue index out of range");
         return NULL;
     }
 
-    QueueNode_t* current = self->head;
-    for (Py_ssize_t i = 0; i < (Py_ssize_t)(index / CHUNKLEN); ++i) {
-        current = current->next;
-    }
-    PyObject* object = current->py_objects[(current->back + index) & CHUNKEND];
+    QueueNode_t* current = Queue_locate(self, &index);
+    PyObject* object =
+        current->chunk->py_objects[(current->back + index) & current->mask];
     Py_INCREF(object);
     return object;
 }
@@ -548,29 +1876,40 @@ static int Queue_setitem(Queue_t* self, Py_ssize_t index, PyObject* object) {
         index += self->length;
     }
 
-    if (index >= self->length) {
+    if (index < 0 || index >= self->length) {
         PyErr_SetString(PyExc_IndexError, "Queue index out of range");
         return -1;
     }
 
-    QueueNode_t* current = self->head;
-    for (Py_ssize_t i = 0; i < (Py_ssize_t)(index / CHUNKLEN); ++i) {
-        current = current->next;
+    QueueNode_t* current = Queue_locate(self, &index);
+    if (!QueueNode_writable(current) && QueueNode_unshare(current) < 0) {
+        return -1;
     }
-    PyObject* oldObject =
-        current->py_objects[(current->back + index) & CHUNKEND];
-    Py_DECREF(oldObject);
+    PyObject** slot =
+        &current->chunk->py_objects[(current->back + index) & current->mask];
+    PyObject* oldObject = *slot;
     Py_INCREF(object);
-    current->py_objects[(current->back + index) & CHUNKEND] = object;
+    *slot = object;
+    GC_item_added((PyObject*)self, &self->gcEntries, object);
+    GC_item_removed((PyObject*)self, &self->gcEntries, oldObject);
+    Py_DECREF(oldObject);
     return 0;
 }
 
 static int Queue_contains(Queue_t* self, PyObject* object) {
     QueueNode_t* current = self->head;
     while (current != NULL) {
+        QueueNode_prefetch_next(current);
         for (Py_ssize_t i = 0; i < current->numEntries; ++i) {
+            if (i + PREFETCH_DISTANCE < current->numEntries) {
+                PREFETCH(current->chunk->py_objects[(current->back + i +
+                                                     PREFETCH_DISTANCE) &
+                                                    current->mask]);
+            }
             if (PyObject_RichCompareBool(
-                    object, current->py_objects[(current->back + i) & CHUNKEND],
+                    object,
+                    current->chunk
+                        ->py_objects[(current->back + i) & current->mask],
                     Py_EQ)) {
                 return 1;
             }
@@ -581,15 +1920,15 @@ static int Queue_contains(Queue_t* self, PyObject* object) {
 }
 
 static PySequenceMethods Queue_sequence_methods = {
-    (lenfunc)Queue_len,             /* sq_length */
-    0,                              /* sq_concat */
-    NULL,                           /* sq_repeat */
-    (ssizeargfunc)Queue_item,       /* sq_item */
-    NULL,                           /* sq_slice */
-    (ssizeobjargproc)Queue_setitem, /* sq_as_item */
-    NULL,                           /* sq_as_slice */
-    (objobjproc)Queue_contains,     /* sq_contains */
-    0                               /* sq_inplace_concat */
+    (lenfunc)Queue_len,              /* sq_length */
+    0,                               /* sq_concat */
+    NULL,                            /* sq_repeat */
+    (ssizeargfunc)Queue_item,        /* sq_item */
+    NULL,                            /* sq_slice */
+    (ssizeobjargproc)Queue_setitem,  /* sq_as_item */
+    NULL,                            /* sq_as_slice */
+    (objobjproc)Queue_contains,      /* sq_contains */
+    (binaryfunc)Queue_inplace_concat /* sq_inplace_concat */
 };
 
 static PyMethodDef Queue_methods[] = {
@@ -597,10 +1936,29 @@ static PyMethodDef Queue_methods[] = {
     {"dequeue", (PyCFunction)Queue_dequeue, METH_NOARGS, dequeue_doc},
     {"is_empty", (PyCFunction)Queue_is_empty, METH_NOARGS, is_empty_doc},
     {"extend", (PyCFunction)Queue_extend, METH_O, extend_doc},
+    {"splice", (PyCFunction)Queue_splice, METH_O, splice_doc},
     {"__copy__", (PyCFunction)Queue_copy, METH_NOARGS, copy_doc},
     {"copy", (PyCFunction)Queue_copy, METH_NOARGS, copy_doc},
+    {"__sizeof__", (PyCFunction)Queue_sizeof, METH_NOARGS, sizeof_doc},
+    {"memory_usage", (PyCFunction)Queue_memory_usage, METH_NOARGS,
+     memory_usage_doc},
     {NULL, NULL, 0, NULL}};
 
+static PyMemberDef Queue_members[] = {
+    {"max_chunk", T_PYSSIZET, offsetof(Queue_t, maxChunk), READONLY,
+     "Largest number of items stored in a single chunk."},
+    {NULL}};
+
+static PyObject* Queue_get_huge_pages(Queue_t* self, void* closure) {
+    return PyBool_FromLong(self->arena != NULL);
+}
+
+static PyGetSetDef Queue_getset[] = {
+    {"huge_pages", (getter)Queue_get_huge_pages, NULL,
+     "Whether full size chunks are carved from huge page backed memory.",
+     NULL},
+    {NULL}};
+
 PyDoc_STRVAR(queue_doc, "Queue() -> Single ended Queue object.");
 static PyTypeObject QueueType = {
     PyVarObject_HEAD_INIT(NULL, 0) "Queue",  /* tp_name */
@@ -630,8 +1988,8 @@ static PyTypeObject QueueType = {
     0,                                       /* tp_iter */
     0,                                       /* tp_iternext */
     Queue_methods,                           /* tp_methods */
-    0,                                       /* tp_members */
-    0,                                       /* tp_getset */
+    Queue_members,                           /* tp_members */
+    Queue_getset,                            /* tp_getset */
     0,                                       /* tp_base */
     0,                                       /* tp_dict */
     0,                                       /* tp_descr_get */
@@ -643,11 +2001,249 @@ static PyTypeObject QueueType = {
     PyObject_GC_Del,                         /* tp_free */
 };
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline long atomic_load_long(volatile long* p) {
+    return _InterlockedCompareExchange(p, 0, 0);
+}
+static inline void atomic_store_long(volatile long* p, long value) {
+    _InterlockedExchange(p, value);
+}
+static inline int atomic_cas_long(volatile long* p, long expected,
+                                  long desired) {
+    return _InterlockedCompareExchange(p, desired, expected) == expected;
+}
+// Py_ssize_t is as wide as a pointer on Windows
+static inline Py_ssize_t atomic_load_ssize(volatile Py_ssize_t* p) {
+    return (Py_ssize_t)_InterlockedCompareExchangePointer(
+        (void* volatile*)p, NULL, NULL);
+}
+static inline void atomic_store_ssize(volatile Py_ssize_t* p,
+                                      Py_ssize_t value) {
+    _InterlockedExchangePointer((void* volatile*)p, (void*)value);
+}
+static inline int atomic_cas_ssize(volatile Py_ssize_t* p,
+                                   Py_ssize_t expected, Py_ssize_t desired) {
+    return _InterlockedCompareExchangePointer((void* volatile*)p,
+                                              (void*)desired,
+                                              (void*)expected) ==
+           (void*)expected;
+}
+static inline void* atomic_load_ptr(void* volatile* p) {
+    return _InterlockedCompareExchangePointer(p, NULL, NULL);
+}
+static inline void atomic_store_ptr(void* volatile* p, void* value) {
+    _InterlockedExchangePointer(p, value);
+}
+static inline void atomic_fence(void) {
+    volatile long fence = 0;
+    _InterlockedExchange(&fence, 1);
+}
+#else
+static inline long atomic_load_long(volatile long* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void atomic_store_long(volatile long* p, long value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+static inline int atomic_cas_long(volatile long* p, long expected,
+                                  long desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+static inline Py_ssize_t atomic_load_ssize(volatile Py_ssize_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void atomic_store_ssize(volatile Py_ssize_t* p,
+                                      Py_ssize_t value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+static inline int atomic_cas_ssize(volatile Py_ssize_t* p,
+                                   Py_ssize_t expected, Py_ssize_t desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+static inline void* atomic_load_ptr(void* volatile* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void atomic_store_ptr(void* volatile* p, void* value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+static inline void atomic_fence(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+// With the GIL the holder of the lock can only make progress once we let go
+// of the GIL, so spinning mostly pays off on free-threaded builds
+#ifdef Py_GIL_DISABLED
+#define LOCKQUEUE_SPIN 128
+#else
+#define LOCKQUEUE_SPIN 8
+#endif
+
+/**
+ * Flat combining: a thread posts its operation to a publication slot and
+ * whichever thread holds the lock applies every posted operation in one
+ * pass, so the lock changes hands once per batch instead of once per item.
+ */
+#define LOCKQUEUE_SLOTS 64
+// A posting thread that is done spinning re-polls its slot this often
+#define LOCKQUEUE_PARK_US 100
+
+enum { SLOT_FREE, SLOT_CLAIMED, SLOT_PENDING, SLOT_DONE };
+enum { OP_ENQUEUE, OP_DEQUEUE };
+enum { OP_OK, OP_EMPTY, OP_FAILED };
+
+typedef struct LockQueueSlot {
+    volatile long state;
+    int op;
+    int status;
+    PyObject* arg;
+    PyObject* result;
+    // Keep neighbouring slots off the same cache line
+    char pad[64 - sizeof(long) - 2 * sizeof(int) - 2 * sizeof(PyObject*)];
+} LockQueueSlot_t;
+
 typedef struct LockQueue {
     PyObject_HEAD Queue_t* queue;
     PyThread_type_lock lock;
+    Py_ssize_t spin;        // Attempts at taking the lock before parking
+    LockQueueSlot_t* slots; // Publication slots, NULL unless combining
 } LockQueue_t;
 
+// Take the lock, spinning briefly before parking the thread with the GIL
+// released so other Python threads, including the holder, keep running
+static void LockQueue_acquire(LockQueue_t* self) {
+    for (Py_ssize_t i = 0; i <= self->spin; ++i) {
+        if (PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+            return;
+        }
+        CPU_RELAX();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+}
+
+static inline void LockQueue_release(LockQueue_t* self) {
+    PyThread_release_lock(self->lock);
+}
+
+// Apply every posted operation, the caller holds the lock
+static void LockQueue_combine(LockQueue_t* self) {
+    Queue_t* queue = self->queue;
+    for (int i = 0; i < LOCKQUEUE_SLOTS; ++i) {
+        LockQueueSlot_t* slot = &self->slots[i];
+        if (atomic_load_long(&slot->state) != SLOT_PENDING) {
+            continue;
+        }
+
+        slot->status = OP_OK;
+        if (slot->op == OP_ENQUEUE) {
+            if (Queue_put(queue, slot->arg) < 0) {
+                PyErr_Clear();
+                slot->status = OP_FAILED;
+            }
+        } else if (queue->length == 0) {
+            slot->status = OP_EMPTY;
+        } else {
+            slot->result = Queue_dequeue(queue);
+        }
+        atomic_store_long(&slot->state, SLOT_DONE);
+    }
+}
+
+// Claim a publication slot for the current thread, NULL if all are taken
+static LockQueueSlot_t* LockQueue_claim_slot(LockQueue_t* self) {
+    unsigned long ident = PyThread_get_thread_ident();
+    size_t start = (size_t)(ident ^ (ident >> 12));
+    for (int i = 0; i < LOCKQUEUE_SLOTS; ++i) {
+        LockQueueSlot_t* slot = &self->slots[(start + i) % LOCKQUEUE_SLOTS];
+        if (atomic_cas_long(&slot->state, SLOT_FREE, SLOT_CLAIMED)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Post an operation and wait until some lock holder, possibly this thread,
+// has applied it
+static PyObject* LockQueue_post(LockQueue_t* self, int op, PyObject* arg) {
+    LockQueueSlot_t* slot = LockQueue_claim_slot(self);
+    if (slot == NULL) {
+        LockQueue_acquire(self);
+        PyObject* result = op == OP_ENQUEUE ? Queue_enqueue(self->queue, arg)
+                                            : Queue_dequeue(self->queue);
+        LockQueue_release(self);
+        return result;
+    }
+
+    slot->op = op;
+    slot->arg = arg;
+    slot->result = NULL;
+    atomic_store_long(&slot->state, SLOT_PENDING);
+
+    int applied = 0;
+    for (Py_ssize_t i = 0; i <= self->spin && !applied; ++i) {
+        if (atomic_load_long(&slot->state) == SLOT_DONE) {
+            applied = 1;
+        } else if (PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+            LockQueue_combine(self);
+            LockQueue_release(self);
+            applied = 1;
+        } else {
+            CPU_RELAX();
+        }
+    }
+    // Park in short bounded waits, a combiner applying the operation in the
+    // meantime is noticed without waiting for the lock to come free
+    while (!applied) {
+        if (atomic_load_long(&slot->state) == SLOT_DONE) {
+            break;
+        }
+        PyLockStatus acquired;
+        Py_BEGIN_ALLOW_THREADS
+        acquired =
+            PyThread_acquire_lock_timed(self->lock, LOCKQUEUE_PARK_US, 0);
+        Py_END_ALLOW_THREADS
+        if (acquired == PY_LOCK_ACQUIRED) {
+            if (atomic_load_long(&slot->state) != SLOT_DONE) {
+                LockQueue_combine(self);
+            }
+            LockQueue_release(self);
+            applied = 1;
+        }
+    }
+
+    int status = slot->status;
+    PyObject* result = slot->result;
+    atomic_store_long(&slot->state, SLOT_FREE);
+
+    if (status == OP_EMPTY) {
+        PyErr_SetString(PyExc_IndexError, "dequeue from an empty Queue");
+        return NULL;
+    }
+    if (status == OP_FAILED) {
+        return PyErr_NoMemory();
+    }
+    if (op == OP_ENQUEUE) {
+        Py_RETURN_NONE;
+    }
+    return result;
+}
+
 static PyObject* LockQueue_new(PyTypeObject* type, PyObject* args,
                                PyObject* kwargs) {
     LockQueue_t* self = (LockQueue_t*)type->tp_alloc(type, 0);
@@ -655,42 +2251,86 @@ static PyObject* LockQueue_new(PyTypeObject* type, PyObject* args,
         return PyErr_NoMemory();
     }
 
-    self->queue = (Queue_t*)Queue_new(&QueueType, args, kwargs);
-    self->lock = NULL;
+    self->spin = LOCKQUEUE_SPIN;
+    self->slots = NULL;
+    self->lock = PyThread_allocate_lock();
+    if (self->lock == NULL) {
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate thread lock.");
+        return NULL;
+    }
+    self->queue = (Queue_t*)Queue_new(&QueueType, NULL, NULL);
+    if (self->queue == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
     return (PyObject*)self;
 }
 
+static PyObject* LockQueue_extend(LockQueue_t* self, PyObject* args);
+
 static int LockQueue_init(LockQueue_t* self, PyObject* args, PyObject* kwargs) {
-    self->lock = PyThread_allocate_lock();
-    if (self == NULL) {
-        PyErr_SetString(PyExc_MemoryError, "Could not allocate thread lock.");
+    static char* kwlist[] = {"iterable", "spin", "combining", NULL};
+    PyObject* iterable = NULL;
+    Py_ssize_t spin = LOCKQUEUE_SPIN;
+    int combining = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$np:LockQueue", kwlist,
+                                     &iterable, &spin, &combining)) {
+        return -1;
+    }
+    if (spin < 0) {
+        PyErr_SetString(PyExc_ValueError, "spin must be non-negative");
         return -1;
     }
-    return Queue_init(self->queue, args, kwargs);
+
+    self->spin = spin;
+    if (combining && self->slots == NULL) {
+        self->slots = (LockQueueSlot_t*)PyMem_Calloc(LOCKQUEUE_SLOTS,
+                                                     sizeof(LockQueueSlot_t));
+        if (self->slots == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    if (iterable != NULL) {
+        PyObject* res = LockQueue_extend(self, iterable);
+        if (res == NULL) {
+            return -1;
+        }
+        Py_DECREF(res);
+    }
+    return 0;
 }
 
 static void LockQueue_dealloc(LockQueue_t* self) {
-    PyThread_free_lock(self->lock);
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(self->queue);
+    if (self->lock != NULL) {
+        PyThread_free_lock(self->lock);
+    }
+    PyMem_Free(self->slots);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+// The items are reported by the inner Queue, which is tracked on its own
 static int LockQueue_traverse(LockQueue_t* self, visitproc visit, void* arg) {
-    return Queue_traverse(self->queue, visit, arg);
+    Py_VISIT(self->queue);
+    return 0;
 }
 
 static int LockQueue_clear(LockQueue_t* self) {
-    PyThread_acquire_lock(self->lock, 1);
+    LockQueue_acquire(self);
     int res = Queue_clear(self->queue);
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return res;
 }
 
 static PyObject* LockQueue_call_with_lock(LockQueue_t* self, PyObject* args,
                                           PyObject* (*func)(Queue_t*,
                                                             PyObject*)) {
-    PyThread_acquire_lock(self->lock, 1);
+    LockQueue_acquire(self);
     PyObject* result = func(self->queue, args);
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return result;
 }
 
@@ -703,57 +2343,111 @@ static PyObject* LockQueue_copy(LockQueue_t* self, PyObject* args) {
 }
 
 static PyObject* LockQueue_enqueue(LockQueue_t* self, PyObject* args) {
+    if (self->slots != NULL) {
+        return LockQueue_post(self, OP_ENQUEUE, args);
+    }
     return LockQueue_call_with_lock(self, args, &Queue_enqueue);
 }
 
 static PyObject* LockQueue_dequeue(LockQueue_t* self) {
-    PyThread_acquire_lock(self->lock, 1);
+    if (self->slots != NULL) {
+        return LockQueue_post(self, OP_DEQUEUE, NULL);
+    }
+    LockQueue_acquire(self);
     PyObject* result = Queue_dequeue(self->queue);
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return result;
 }
 
+// Iterables are drained before the lock is taken, so they may read the queue
+// and the lock is only held for one bulk copy
 static PyObject* LockQueue_extend(LockQueue_t* self, PyObject* args) {
-    return LockQueue_call_with_lock(self, args, &Queue_extend);
+    if (PyList_CheckExact(args) || PyTuple_CheckExact(args)) {
+        return LockQueue_call_with_lock(self, args, &Queue_extend);
+    }
+
+    PyObject* iterable = PyObject_GetIter(args);
+    if (iterable == NULL) {
+        PyErr_Format(PyExc_TypeError, "Expected 'Iterable', got '%s'",
+                     Py_TYPE(args)->tp_name);
+        return NULL;
+    }
+    PyObject* items = PySequence_List(iterable);
+    Py_DECREF(iterable);
+    if (items == NULL) {
+        return NULL;
+    }
+    PyObject* result = LockQueue_call_with_lock(self, items, &Queue_extend);
+    Py_DECREF(items);
+    return result;
 }
 
 static PyObject* LockQueue_item(LockQueue_t* self, Py_ssize_t index) {
-    PyThread_acquire_lock(self->lock, 1);
+    LockQueue_acquire(self);
     PyObject* result = Queue_item(self->queue, index);
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return result;
 }
 
 static Py_ssize_t LockQueue_len(LockQueue_t* self) {
-    PyThread_acquire_lock(self->lock, 1);
+    LockQueue_acquire(self);
     Py_ssize_t res = self->queue->length;
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return res;
 }
 
 static int LockQueue_setitem(LockQueue_t* self, Py_ssize_t index,
                              PyObject* args) {
-    PyThread_acquire_lock(self->lock, 1);
+    LockQueue_acquire(self);
     int res = Queue_setitem(self->queue, index, args);
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return res;
 }
 
 static int LockQueue_contains(LockQueue_t* self, PyObject* args) {
-    PyThread_acquire_lock(self->lock, 1);
+    LockQueue_acquire(self);
     int res = Queue_contains(self->queue, args);
-    PyThread_release_lock(self->lock);
+    LockQueue_release(self);
     return res;
 }
 
+// The inner Queue and the combining slots are counted as part of the LockQueue
+static void LockQueue_memory(LockQueue_t* self, Py_ssize_t* used,
+                             Py_ssize_t* spare) {
+    *used += Py_TYPE(self)->tp_basicsize;
+    if (self->slots != NULL) {
+        *used += LOCKQUEUE_SLOTS * sizeof(LockQueueSlot_t);
+    }
+    LockQueue_acquire(self);
+    Queue_memory(self->queue, used, spare);
+    LockQueue_release(self);
+}
+
+static PyObject* LockQueue_sizeof(LockQueue_t* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    LockQueue_memory(self, &used, &spare);
+    return PyLong_FromSsize_t(used + spare);
+}
+
+static PyObject* LockQueue_memory_usage(LockQueue_t* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    LockQueue_memory(self, &used, &spare);
+    return memory_usage_new(used, spare);
+}
+
 PyDoc_STRVAR(
     get_doc,
     "Return the first element of the LockQueue, None if no element exists.");
 static PyObject* LockQueue_get(LockQueue_t* self, PyObject* args) {
-    if (LockQueue_len(self) > 0) {
-        return LockQueue_dequeue(self);
+    PyObject* result = Py_None;
+    LockQueue_acquire(self);
+    if (self->queue->length > 0) {
+        result = Queue_dequeue(self->queue);
+    } else {
+        Py_INCREF(result);
     }
-    Py_RETURN_NONE;
+    LockQueue_release(self);
+    return result;
 }
 
 static PyMethodDef LockQueue_methods[] = {
@@ -764,6 +2458,9 @@ static PyMethodDef LockQueue_methods[] = {
     {"__copy__", (PyCFunction)LockQueue_copy, METH_NOARGS, copy_doc},
     {"copy", (PyCFunction)LockQueue_copy, METH_NOARGS, copy_doc},
     {"get", (PyCFunction)LockQueue_get, METH_NOARGS, get_doc},
+    {"__sizeof__", (PyCFunction)LockQueue_sizeof, METH_NOARGS, sizeof_doc},
+    {"memory_usage", (PyCFunction)LockQueue_memory_usage, METH_NOARGS,
+     memory_usage_doc},
     {NULL, NULL, 0, NULL}};
 
 static PySequenceMethods LockQueue_sequence_methods = {
@@ -778,6 +2475,41 @@ static PySequenceMethods LockQueue_sequence_methods = {
     0                                   /* sq_inplace_concat */
 };
 
+PyDoc_STRVAR(combining_doc,
+             "Whether enqueue and dequeue are applied in batches by the "
+             "thread holding the lock.");
+static PyObject* LockQueue_get_combining(LockQueue_t* self, void* closure) {
+    return PyBool_FromLong(self->slots != NULL);
+}
+
+static PyObject* LockQueue_get_spin(LockQueue_t* self, void* closure) {
+    return PyLong_FromSsize_t(self->spin);
+}
+
+static int LockQueue_set_spin(LockQueue_t* self, PyObject* value,
+                              void* closure) {
+    if (value == NULL) {
+        PyErr_SetString(PyExc_AttributeError, "cannot delete spin");
+        return -1;
+    }
+    Py_ssize_t spin = PyNumber_AsSsize_t(value, PyExc_OverflowError);
+    if (spin == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (spin < 0) {
+        PyErr_SetString(PyExc_ValueError, "spin must be non-negative");
+        return -1;
+    }
+    self->spin = spin;
+    return 0;
+}
+
+static PyGetSetDef LockQueue_getset[] = {
+    {"combining", (getter)LockQueue_get_combining, NULL, combining_doc, NULL},
+    {"spin", (getter)LockQueue_get_spin, (setter)LockQueue_set_spin,
+     "Attempts at taking the lock before a thread parks.", NULL},
+    {NULL}};
+
 PyDoc_STRVAR(lockqueue_doc,
              "LockQueue() -> Single ended synchronous Queue object.");
 static PyTypeObject LockQueueType = {
@@ -809,7 +2541,7 @@ static PyTypeObject LockQueueType = {
     0,                                          /* tp_iternext */
     LockQueue_methods,                          /* tp_methods */
     0,                                          /* tp_members */
-    0,                                          /* tp_getset */
+    LockQueue_getset,                           /* tp_getset */
     0,                                          /* tp_base */
     0,                                          /* tp_dict */
     0,                                          /* tp_descr_get */
@@ -821,22 +2553,2790 @@ static PyTypeObject LockQueueType = {
     PyObject_GC_Del,                            /* tp_free */
 };
 
-PyDoc_STRVAR(fastqueue_doc,
-             "Single ended fast queue's built in C tuned for python.");
-static PyModuleDef QueueModuleDef = {PyModuleDef_HEAD_INIT,
-                                     "_fastqueue",
-                                     fastqueue_doc,
-                                     -1,
-                                     NULL,
-                                     NULL,
-                                     NULL,
-                                     NULL,
-                                     NULL};
+/**
+ * Single ended Python Queue with an index of the items it holds
+ * --- fastqueue.IndexedQueue ---
+ */
+typedef struct IndexedQueue {
+    PyObject_HEAD Queue_t* queue;
+    PyObject* counts; // Maps each held item to its number of occurrences
+    char unique;
+} IndexedQueue_t;
 
-PyMODINIT_FUNC PyInit__fastqueue(void) {
-    PyObject* module;
-    if (PyType_Ready(&QueueType) < 0 || PyType_Ready(&QueueCType) < 0 ||
-        PyType_Ready(&LockQueueType) < 0) {
+// Record one more occurrence of py_object, returns 0 if it is a duplicate
+// that should be skipped and -1 on error
+static int IndexedQueue_index_add(IndexedQueue_t* self, PyObject* py_object) {
+    // Dict lookups compare by identity before falling back to __eq__
+    PyObject* count = PyDict_GetItemWithError(self->counts, py_object);
+    if (count == NULL) {
+        if (PyErr_Occurred()) {
+            return -1;
+        }
+        count = PyLong_FromSsize_t(1);
+    } else if (self->unique) {
+        return 0;
+    } else {
+        count = PyLong_FromSsize_t(PyLong_AsSsize_t(count) + 1);
+    }
+
+    if (count == NULL) {
+        return -1;
+    }
+    int res = PyDict_SetItem(self->counts, py_object, count);
+    Py_DECREF(count);
+    return res < 0 ? -1 : 1;
+}
+
+// Forget one occurrence of py_object
+static int IndexedQueue_index_remove(IndexedQueue_t* self,
+                                     PyObject* py_object) {
+    PyObject* count = PyDict_GetItemWithError(self->counts, py_object);
+    if (count == NULL) {
+        return PyErr_Occurred() ? -1 : 0;
+    }
+
+    Py_ssize_t n = PyLong_AsSsize_t(count);
+    if (n <= 1) {
+        return PyDict_DelItem(self->counts, py_object);
+    }
+    count = PyLong_FromSsize_t(n - 1);
+    if (count == NULL) {
+        return -1;
+    }
+    int res = PyDict_SetItem(self->counts, py_object, count);
+    Py_DECREF(count);
+    return res;
+}
+
+static PyObject* IndexedQueue_new(PyTypeObject* type, PyObject* args,
+                                  PyObject* kwargs) {
+    IndexedQueue_t* self = (IndexedQueue_t*)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    self->unique = 0;
+    self->queue = (Queue_t*)Queue_new(&QueueType, NULL, NULL);
+    self->counts = PyDict_New();
+    if (self->queue == NULL || self->counts == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject*)self;
+}
+
+static void IndexedQueue_dealloc(IndexedQueue_t* self) {
+    PyObject_GC_UnTrack(self);
+    Py_XDECREF(self->queue);
+    Py_XDECREF(self->counts);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int IndexedQueue_traverse(IndexedQueue_t* self, visitproc visit,
+                                 void* arg) {
+    Py_VISIT(self->queue);
+    Py_VISIT(self->counts);
+    return 0;
+}
+
+// Empties the queue and its index but keeps both, methods rely on them
+static int IndexedQueue_clear(IndexedQueue_t* self) {
+    if (self->queue != NULL) {
+        Queue_clear(self->queue);
+    }
+    if (self->counts != NULL) {
+        PyDict_Clear(self->counts);
+    }
+    return 0;
+}
+
+static PyObject* IndexedQueue_is_empty(IndexedQueue_t* self, PyObject* args) {
+    return Queue_is_empty(self->queue, args);
+}
+
+PyDoc_STRVAR(indexed_enqueue_doc,
+             "Add an item to the front of the IndexedQueue. Returns False if "
+             "the item was skipped as a duplicate.");
+static PyObject* IndexedQueue_enqueue(IndexedQueue_t* self,
+                                      PyObject* py_object) {
+    int res = IndexedQueue_index_add(self, py_object);
+    if (res < 0) {
+        return NULL;
+    }
+    if (res == 0) {
+        Py_RETURN_FALSE;
+    }
+
+    PyObject* ok = Queue_enqueue(self->queue, py_object);
+    if (ok == NULL) {
+        IndexedQueue_index_remove(self, py_object);
+        return NULL;
+    }
+    Py_DECREF(ok);
+    Py_RETURN_TRUE;
+}
+
+static PyObject* IndexedQueue_dequeue(IndexedQueue_t* self) {
+    PyObject* py_object = Queue_dequeue(self->queue);
+    if (py_object == NULL) {
+        return NULL;
+    }
+    if (IndexedQueue_index_remove(self, py_object) < 0) {
+        Py_DECREF(py_object);
+        return NULL;
+    }
+    return py_object;
+}
+
+static PyObject* IndexedQueue_extend(IndexedQueue_t* self,
+                                     PyObject* iterator) {
+    if (iterator == (PyObject*)self) {
+        // Snapshot the queue so it does not keep growing under us
+        PyObject* items = PySequence_List(iterator);
+        if (items == NULL) {
+            return NULL;
+        }
+        PyObject* res = IndexedQueue_extend(self, items);
+        Py_DECREF(items);
+        return res;
+    }
+
+    PyObject* iterable = PyObject_GetIter(iterator);
+    if (iterable == NULL) {
+        PyErr_Format(PyExc_TypeError, "Expected 'Iterable', got '%s'",
+                     Py_TYPE(iterator)->tp_name);
+        return NULL;
+    }
+
+    PyObject* py_object;
+    while ((py_object = PyIter_Next(iterable)) != NULL) {
+        PyObject* res = IndexedQueue_enqueue(self, py_object);
+        Py_DECREF(py_object);
+        if (res == NULL) {
+            break;
+        }
+        Py_DECREF(res);
+    }
+    Py_DECREF(iterable);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int IndexedQueue_init(IndexedQueue_t* self, PyObject* args,
+                             PyObject* kwargs) {
+    static char* kwlist[] = {"iterable", "unique", NULL};
+    PyObject* iterable = NULL;
+    int unique = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Op:IndexedQueue", kwlist,
+                                     &iterable, &unique)) {
+        return -1;
+    }
+
+    self->unique = (char)unique;
+    if (iterable != NULL) {
+        PyObject* res = IndexedQueue_extend(self, iterable);
+        if (res == NULL) {
+            return -1;
+        }
+        Py_DECREF(res);
+    }
+    return 0;
+}
+
+static PyObject* IndexedQueue_copy(IndexedQueue_t* self, PyObject* args) {
+    IndexedQueue_t* copy =
+        (IndexedQueue_t*)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
+    if (copy == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    copy->unique = self->unique;
+    copy->queue = (Queue_t*)Queue_copy(self->queue, NULL);
+    copy->counts = PyDict_Copy(self->counts);
+    if (copy->queue == NULL || copy->counts == NULL) {
+        Py_DECREF(copy);
+        return NULL;
+    }
+    return (PyObject*)copy;
+}
+
+static Py_ssize_t IndexedQueue_len(IndexedQueue_t* self) {
+    return self->queue->length;
+}
+
+static PyObject* IndexedQueue_item(IndexedQueue_t* self, Py_ssize_t index) {
+    return Queue_item(self->queue, index);
+}
+
+static int IndexedQueue_setitem(IndexedQueue_t* self, Py_ssize_t index,
+                                PyObject* object) {
+    PyObject* oldObject = Queue_item(self->queue, index);
+    if (oldObject == NULL) {
+        return -1;
+    }
+    // Unhashable items fail before the index is touched
+    if (PyObject_Hash(object) == -1) {
+        Py_DECREF(oldObject);
+        return -1;
+    }
+
+    int res = IndexedQueue_index_remove(self, oldObject);
+    if (res < 0) {
+        Py_DECREF(oldObject);
+        return -1;
+    }
+    int added = IndexedQueue_index_add(self, object);
+    if (added == 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "item is already in the IndexedQueue");
+    } else if (added > 0) {
+        res = Queue_setitem(self->queue, index, object);
+    }
+
+    if (added <= 0 || res < 0) {
+        // Restore the index as it was, keeping the error that got us here
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        if (added > 0) {
+            IndexedQueue_index_remove(self, object);
+        }
+        IndexedQueue_index_add(self, oldObject);
+        PyErr_Restore(type, value, traceback);
+        res = -1;
+    }
+    Py_DECREF(oldObject);
+    return res;
+}
+
+static int IndexedQueue_contains(IndexedQueue_t* self, PyObject* object) {
+    return PyDict_Contains(self->counts, object);
+}
+
+PyDoc_STRVAR(count_doc, "Return the number of occurrences of an item.");
+static PyObject* IndexedQueue_count(IndexedQueue_t* self, PyObject* object) {
+    PyObject* count = PyDict_GetItemWithError(self->counts, object);
+    if (count == NULL) {
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        return PyLong_FromLong(0);
+    }
+    Py_INCREF(count);
+    return count;
+}
+
+// The inner Queue and the index are counted as part of the IndexedQueue
+static int IndexedQueue_memory(IndexedQueue_t* self, Py_ssize_t* used,
+                               Py_ssize_t* spare) {
+    PyObject* size = PyObject_CallMethod(self->counts, "__sizeof__", NULL);
+    if (size == NULL) {
+        return -1;
+    }
+    Py_ssize_t counts = PyLong_AsSsize_t(size);
+    Py_DECREF(size);
+    if (counts < 0) {
+        return -1;
+    }
+    *used += Py_TYPE(self)->tp_basicsize + counts;
+    Queue_memory(self->queue, used, spare);
+    return 0;
+}
+
+static PyObject* IndexedQueue_sizeof(IndexedQueue_t* self, PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    if (IndexedQueue_memory(self, &used, &spare) < 0) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(used + spare);
+}
+
+static PyObject* IndexedQueue_memory_usage(IndexedQueue_t* self,
+                                           PyObject* args) {
+    Py_ssize_t used = 0, spare = 0;
+    if (IndexedQueue_memory(self, &used, &spare) < 0) {
+        return NULL;
+    }
+    return memory_usage_new(used, spare);
+}
+
+static PySequenceMethods IndexedQueue_sequence_methods = {
+    (lenfunc)IndexedQueue_len,             /* sq_length */
+    0,                                     /* sq_concat */
+    NULL,                                  /* sq_repeat */
+    (ssizeargfunc)IndexedQueue_item,       /* sq_item */
+    NULL,                                  /* sq_slice */
+    (ssizeobjargproc)IndexedQueue_setitem, /* sq_as_item */
+    NULL,                                  /* sq_as_slice */
+    (objobjproc)IndexedQueue_contains,     /* sq_contains */
+    0                                      /* sq_inplace_concat */
+};
+
+static PyMethodDef IndexedQueue_methods[] = {
+    {"enqueue", (PyCFunction)IndexedQueue_enqueue, METH_O,
+     indexed_enqueue_doc},
+    {"dequeue", (PyCFunction)IndexedQueue_dequeue, METH_NOARGS, dequeue_doc},
+    {"is_empty", (PyCFunction)IndexedQueue_is_empty, METH_NOARGS,
+     is_empty_doc},
+    {"extend", (PyCFunction)IndexedQueue_extend, METH_O, extend_doc},
+    {"count", (PyCFunction)IndexedQueue_count, METH_O, count_doc},
+    {"__copy__", (PyCFunction)IndexedQueue_copy, METH_NOARGS, copy_doc},
+    {"copy", (PyCFunction)IndexedQueue_copy, METH_NOARGS, copy_doc},
+    {"__sizeof__", (PyCFunction)IndexedQueue_sizeof, METH_NOARGS, sizeof_doc},
+    {"memory_usage", (PyCFunction)IndexedQueue_memory_usage, METH_NOARGS,
+     memory_usage_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyMemberDef IndexedQueue_members[] = {
+    {"unique", T_BOOL, offsetof(IndexedQueue_t, unique), READONLY,
+     "Whether duplicate items are skipped on enqueue."},
+    {NULL}};
+
+PyDoc_STRVAR(indexedqueue_doc,
+             "IndexedQueue() -> Single ended Queue object with O(1) "
+             "membership tests.");
+static PyTypeObject IndexedQueueType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "IndexedQueue", /* tp_name */
+    sizeof(IndexedQueue_t),                        /* tp_basicsize */
+    0,                                             /* tp_itemsize */
+    (destructor)IndexedQueue_dealloc,              /* tp_dealloc */
+    0,                                             /* tp_print */
+    0,                                             /* tp_getattr */
+    0,                                             /* tp_setattr */
+    0,                                             /* tp_reserved */
+    0,                                             /* tp_repr */
+    0,                                             /* tp_as_number */
+    &IndexedQueue_sequence_methods,                /* tp_as_sequence */
+    0,                                             /* tp_as_mapping */
+    PyObject_HashNotImplemented,                   /* tp_hash */
+    0,                                             /* tp_call */
+    0,                                             /* tp_str */
+    PyObject_GenericGetAttr,                       /* tp_getattro */
+    0,                                             /* tp_setattro */
+    0,                                             /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,       /* tp_flags */
+    indexedqueue_doc,                              /* tp_doc */
+    (traverseproc)IndexedQueue_traverse,           /* tp_traverse */
+    (inquiry)IndexedQueue_clear,                   /* tp_clear */
+    0,                                             /* tp_richcompare */
+    0,                                             /* tp_weaklistoffset */
+    0,                                             /* tp_iter */
+    0,                                             /* tp_iternext */
+    IndexedQueue_methods,                          /* tp_methods */
+    IndexedQueue_members,                          /* tp_members */
+    0,                                             /* tp_getset */
+    0,                                             /* tp_base */
+    0,                                             /* tp_dict */
+    0,                                             /* tp_descr_get */
+    0,                                             /* tp_descr_set */
+    0,                                             /* tp_dictoffset */
+    (initproc)IndexedQueue_init,                   /* tp_init */
+    PyType_GenericAlloc,                           /* tp_alloc */
+    (newfunc)IndexedQueue_new,                     /* tp_new */
+    PyObject_GC_Del,                               /* tp_free */
+};
+
+/**
+ * Fixed size window over a stream of numbers with running aggregates
+ * --- fastqueue.WindowQueue ---
+ *
+ * Values are kept unboxed in a ring laid out like the one of QueueC. The ring
+ * holds int64 values until the first float arrives or an integer sum would
+ * overflow, from then on it holds doubles. Min and max are the fronts of two
+ * monotonic deques of sequence numbers, every value enters and leaves each
+ * deque at most once so enqueue is O(1) amortized.
+ */
+#define WINDOW_SUM 1
+#define WINDOW_MIN 2
+#define WINDOW_MAX 4
+
+typedef union WindowValue {
+    int64_t i;
+    double d;
+} WindowValue_t;
+
+// Sequence numbers of the values that can still become the min or max
+typedef struct WindowDeque {
+    size_t* seqs;
+    size_t back;  // Index of the oldest sequence number
+    size_t front; // One past the newest sequence number
+} WindowDeque_t;
+
+typedef struct WindowQueue {
+    PyObject_HEAD Py_ssize_t maxlen;
+    size_t mask;  // Capacity of the ring minus one, a power of two
+    size_t back;  // Sequence number of the oldest value
+    size_t front; // Sequence number the next value gets
+    WindowValue_t* values;
+    int aggregates;
+    char isFloat;
+    int64_t intSum;
+    double floatSum;  // Sum of the finite values
+    double floatComp; // Neumaier compensation of floatSum
+    Py_ssize_t nans;
+    Py_ssize_t posInfs;
+    Py_ssize_t negInfs;
+    WindowDeque_t minDeque;
+    WindowDeque_t maxDeque;
+} WindowQueue_t;
+
+static PyTypeObject WindowQueueType;
+
+static inline Py_ssize_t WindowQueue_length(WindowQueue_t* self) {
+    return (Py_ssize_t)(self->front - self->back);
+}
+
+static inline WindowValue_t* WindowQueue_at(WindowQueue_t* self, size_t seq) {
+    return &self->values[seq & self->mask];
+}
+
+static PyObject* WindowValue_box(WindowQueue_t* self, WindowValue_t value) {
+    if (self->isFloat) {
+        return PyFloat_FromDouble(value.d);
+    }
+    return PyLong_FromLongLong(value.i);
+}
+
+// Whether a stays in front of b in a deque ordered by cmp, where cmp < 0
+// keeps the minimum and cmp > 0 the maximum at the front
+static inline int WindowValue_precedes(WindowQueue_t* self, WindowValue_t a,
+                                       WindowValue_t b, int cmp) {
+    if (self->isFloat) {
+        return cmp < 0 ? a.d < b.d : a.d > b.d;
+    }
+    return cmp < 0 ? a.i < b.i : a.i > b.i;
+}
+
+static inline void WindowDeque_push(WindowQueue_t* self, WindowDeque_t* deque,
+                                    size_t seq, int cmp) {
+    WindowValue_t value = *WindowQueue_at(self, seq);
+    while (deque->front != deque->back) {
+        size_t newest = deque->seqs[(deque->front - 1) & self->mask];
+        if (WindowValue_precedes(self, *WindowQueue_at(self, newest), value,
+                                 cmp)) {
+            break;
+        }
+        deque->front--;
+    }
+    deque->seqs[deque->front++ & self->mask] = seq;
+}
+
+static inline void WindowDeque_evict(WindowQueue_t* self, WindowDeque_t* deque,
+                                     size_t seq) {
+    if (deque->front != deque->back &&
+        deque->seqs[deque->back & self->mask] == seq) {
+        deque->back++;
+    }
+}
+
+static void WindowQueue_add_float(WindowQueue_t* self, double value,
+                                  int sign) {
+    if (Py_IS_NAN(value)) {
+        self->nans += sign;
+    } else if (Py_IS_INFINITY(value)) {
+        if (value > 0) {
+            self->posInfs += sign;
+        } else {
+            self->negInfs += sign;
+        }
+    } else {
+        value *= sign;
+        double sum = self->floatSum + value;
+        if (fabs(self->floatSum) >= fabs(value)) {
+            self->floatComp += (self->floatSum - sum) + value;
+        } else {
+            self->floatComp += (value - sum) + self->floatSum;
+        }
+        self->floatSum = sum;
+    }
+}
+
+// Switch the ring over to doubles and sum it up again from scratch
+static void WindowQueue_to_float(WindowQueue_t* self) {
+    self->floatSum = 0.0;
+    self->floatComp = 0.0;
+    for (size_t seq = self->back; seq != self->front; ++seq) {
+        WindowValue_t* value = WindowQueue_at(self, seq);
+        value->d = (double)value->i;
+        WindowQueue_add_float(self, value->d, 1);
+    }
+    self->isFloat = 1;
+}
+
+static inline int int64_add_overflows(int64_t a, int64_t b) {
+    return (b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b);
+}
+
+// Drop the oldest value from the window and its aggregates
+static WindowValue_t WindowQueue_evict(WindowQueue_t* self) {
+    size_t seq = self->back;
+    if (self->aggregates & WINDOW_SUM) {
+        if (!self->isFloat) {
+            int64_t value = WindowQueue_at(self, seq)->i;
+            if (value != INT64_MIN &&
+                !int64_add_overflows(self->intSum, -value)) {
+                self->intSum -= value;
+            } else {
+                WindowQueue_to_float(self);
+            }
+        }
+        if (self->isFloat) {
+            WindowQueue_add_float(self, WindowQueue_at(self, seq)->d, -1);
+        }
+    }
+    if (self->aggregates & WINDOW_MIN) {
+        WindowDeque_evict(self, &self->minDeque, seq);
+    }
+    if (self->aggregates & WINDOW_MAX) {
+        WindowDeque_evict(self, &self->maxDeque, seq);
+    }
+    self->back++;
+    if (self->back == self->front) {
+        // Start the next window without rounding errors left behind
+        self->floatSum = 0.0;
+        self->floatComp = 0.0;
+    }
+    return *WindowQueue_at(self, seq);
+}
+
+// Convert a Python number to the representation of the window
+static int WindowQueue_unbox(WindowQueue_t* self, PyObject* object,
+                             WindowValue_t* value) {
+    double d;
+    if (PyLong_Check(object)) {
+        int overflow;
+        long long i = PyLong_AsLongLongAndOverflow(object, &overflow);
+        if (i == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (!overflow) {
+            if (self->isFloat) {
+                value->d = (double)i;
+            } else {
+                value->i = i;
+            }
+            return 0;
+        }
+        d = PyLong_AsDouble(object);
+    } else {
+        d = PyFloat_AsDouble(object);
+    }
+    if (d == -1.0 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (!self->isFloat) {
+        WindowQueue_to_float(self);
+    }
+    value->d = d;
+    return 0;
+}
+
+static int WindowQueue_push(WindowQueue_t* self, PyObject* object) {
+    WindowValue_t value;
+    if (WindowQueue_unbox(self, object, &value) < 0) {
+        return -1;
+    }
+    char wasFloat = self->isFloat;
+    if (WindowQueue_length(self) == self->maxlen) {
+        WindowQueue_evict(self);
+    }
+    if ((self->aggregates & WINDOW_SUM) && !self->isFloat &&
+        int64_add_overflows(self->intSum, value.i)) {
+        WindowQueue_to_float(self);
+    }
+    if (self->isFloat && !wasFloat) {
+        value.d = (double)value.i;
+    }
+
+    if (self->aggregates & WINDOW_SUM) {
+        if (self->isFloat) {
+            WindowQueue_add_float(self, value.d, 1);
+        } else {
+            self->intSum += value.i;
+        }
+    }
+
+    size_t seq = self->front++;
+    *WindowQueue_at(self, seq) = value;
+    if (self->aggregates & WINDOW_MIN) {
+        WindowDeque_push(self, &self->minDeque, seq, -1);
+    }
+    if (self->aggregates & WINDOW_MAX) {
+        WindowDeque_push(self, &self->maxDeque, seq, 1);
+    }
+    return 0;
+}
+
+static int WindowQueue_parse_aggregates(PyObject* names) {
+    if (names == NULL || names == Py_None) {
+        return WINDOW_SUM | WINDOW_MIN | WINDOW_MAX;
+    }
+    if (PyUnicode_Check(names)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "aggregates must be an iterable of names");
+        return -1;
+    }
+
+    PyObject* iterable = PyObject_GetIter(names);
+    if (iterable == NULL) {
+        return -1;
+    }
+    int aggregates = 0;
+    PyObject* name;
+    while ((name = PyIter_Next(iterable)) != NULL) {
+        int flag = 0;
+        if (PyUnicode_Check(name)) {
+            if (PyUnicode_CompareWithASCIIString(name, "sum") == 0 ||
+                PyUnicode_CompareWithASCIIString(name, "mean") == 0) {
+                flag = WINDOW_SUM;
+            } else if (PyUnicode_CompareWithASCIIString(name, "min") == 0) {
+                flag = WINDOW_MIN;
+            } else if (PyUnicode_CompareWithASCIIString(name, "max") == 0) {
+                flag = WINDOW_MAX;
+            }
+        }
+        if (flag == 0) {
+            PyErr_Format(PyExc_ValueError,
+                         "unknown aggregate %R, expected 'sum', 'mean', "
+                         "'min' or 'max'",
+                         name);
+        }
+        Py_DECREF(name);
+        if (flag == 0) {
+            break;
+        }
+        aggregates |= flag;
+    }
+    Py_DECREF(iterable);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+    return aggregates;
+}
+
+static PyObject* WindowQueue_new(PyTypeObject* type, PyObject* args,
+                                 PyObject* kwargs) {
+    static char* kwlist[] = {"maxlen", "aggregates", NULL};
+    Py_ssize_t maxlen;
+    PyObject* names = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|O:WindowQueue", kwlist,
+                                     &maxlen, &names)) {
+        return NULL;
+    }
+    if (maxlen < 1) {
+        PyErr_SetString(PyExc_ValueError, "maxlen must be positive");
+        return NULL;
+    }
+    if (maxlen > PY_SSIZE_T_MAX / 2 / (Py_ssize_t)sizeof(WindowValue_t)) {
+        return PyErr_NoMemory();
+    }
+    int aggregates = WindowQueue_parse_aggregates(names);
+    if (aggregates < 0) {
+        return NULL;
+    }
+
+    WindowQueue_t* self = (WindowQueue_t*)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+    size_t capacity = 1;
+    while (capacity < (size_t)maxlen) {
+        capacity *= 2;
+    }
+    self->maxlen = maxlen;
+    self->mask = capacity - 1;
+    self->aggregates = aggregates;
+    self->values =
+        (WindowValue_t*)PyMem_Malloc(capacity * sizeof(WindowValue_t));
+    if (aggregates & WINDOW_MIN) {
+        self->minDeque.seqs =
+            (size_t*)PyMem_Malloc(capacity * sizeof(size_t));
+    }
+    if (aggregates & WINDOW_MAX) {
+        self->maxDeque.seqs =
+            (size_t*)PyMem_Malloc(capacity * sizeof(size_t));
+    }
+    if (self->values == NULL ||
+        ((aggregates & WINDOW_MIN) && self->minDeque.seqs == NULL) ||
+        ((aggregates & WINDOW_MAX) && self->maxDeque.seqs == NULL)) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject*)self;
+}
+
+static void WindowQueue_dealloc(WindowQueue_t* self) {
+    PyMem_Free(self->values);
+    PyMem_Free(self->minDeque.seqs);
+    PyMem_Free(self->maxDeque.seqs);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* WindowQueue_is_empty(WindowQueue_t* self, PyObject* args) {
+    if (WindowQueue_length(self)) {
+        Py_RETURN_FALSE;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject* WindowQueue_enqueue(WindowQueue_t* self, PyObject* object) {
+    if (WindowQueue_push(self, object) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* WindowQueue_dequeue(WindowQueue_t* self) {
+    if (WindowQueue_length(self) == 0) {
+        PyErr_SetString(PyExc_IndexError, "dequeue from an empty Queue");
+        return NULL;
+    }
+    return WindowValue_box(self, WindowQueue_evict(self));
+}
+
+static PyObject* WindowQueue_extend(WindowQueue_t* self, PyObject* iterator) {
+    PyObject* iterable = PyObject_GetIter(iterator);
+    if (iterable == NULL) {
+        PyErr_Format(PyExc_TypeError, "Expected 'Iterable', got '%s'",
+                     Py_TYPE(iterator)->tp_name);
+        return NULL;
+    }
+
+    PyObject* object;
+    while ((object = PyIter_Next(iterable)) != NULL) {
+        int res = WindowQueue_push(self, object);
+        Py_DECREF(object);
+        if (res < 0) {
+            break;
+        }
+    }
+    Py_DECREF(iterable);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* WindowQueue_sizeof(WindowQueue_t* self, PyObject* args) {
+    size_t capacity = self->mask + 1;
+    Py_ssize_t size = Py_TYPE(self)->tp_basicsize +
+                      capacity * sizeof(WindowValue_t);
+    if (self->aggregates & WINDOW_MIN) {
+        size += capacity * sizeof(size_t);
+    }
+    if (self->aggregates & WINDOW_MAX) {
+        size += capacity * sizeof(size_t);
+    }
+    return PyLong_FromSsize_t(size);
+}
+
+static Py_ssize_t WindowQueue_len(WindowQueue_t* self) {
+    return WindowQueue_length(self);
+}
+
+static PyObject* WindowQueue_item(WindowQueue_t* self, Py_ssize_t index) {
+    if (index < 0 || index >= WindowQueue_length(self)) {
+        PyErr_SetString(PyExc_IndexError, "Queue index out of range");
+        return NULL;
+    }
+    return WindowValue_box(self, *WindowQueue_at(self, self->back + index));
+}
+
+static int WindowQueue_tracks(WindowQueue_t* self, int flag,
+                              const char* name) {
+    if (!(self->aggregates & flag)) {
+        PyErr_Format(PyExc_ValueError, "this WindowQueue does not track '%s'",
+                     name);
+        return 0;
+    }
+    return 1;
+}
+
+static double WindowQueue_float_sum(WindowQueue_t* self) {
+    if (self->nans > 0 || (self->posInfs > 0 && self->negInfs > 0)) {
+        return Py_NAN;
+    }
+    if (self->posInfs > 0) {
+        return Py_HUGE_VAL;
+    }
+    if (self->negInfs > 0) {
+        return -Py_HUGE_VAL;
+    }
+    return self->floatSum + self->floatComp;
+}
+
+static PyObject* WindowQueue_get_sum(WindowQueue_t* self, void* closure) {
+    if (!WindowQueue_tracks(self, WINDOW_SUM, "sum")) {
+        return NULL;
+    }
+    if (self->isFloat) {
+        return PyFloat_FromDouble(WindowQueue_float_sum(self));
+    }
+    return PyLong_FromLongLong(self->intSum);
+}
+
+static PyObject* WindowQueue_get_mean(WindowQueue_t* self, void* closure) {
+    if (!WindowQueue_tracks(self, WINDOW_SUM, "mean")) {
+        return NULL;
+    }
+    Py_ssize_t length = WindowQueue_length(self);
+    if (length == 0) {
+        Py_RETURN_NONE;
+    }
+    double sum = self->isFloat ? WindowQueue_float_sum(self)
+                               : (double)self->intSum;
+    return PyFloat_FromDouble(sum / length);
+}
+
+static PyObject* WindowQueue_get_extreme(WindowQueue_t* self,
+                                         WindowDeque_t* deque) {
+    if (deque->front == deque->back) {
+        Py_RETURN_NONE;
+    }
+    return WindowValue_box(
+        self, *WindowQueue_at(self, deque->seqs[deque->back & self->mask]));
+}
+
+static PyObject* WindowQueue_get_min(WindowQueue_t* self, void* closure) {
+    if (!WindowQueue_tracks(self, WINDOW_MIN, "min")) {
+        return NULL;
+    }
+    return WindowQueue_get_extreme(self, &self->minDeque);
+}
+
+static PyObject* WindowQueue_get_max(WindowQueue_t* self, void* closure) {
+    if (!WindowQueue_tracks(self, WINDOW_MAX, "max")) {
+        return NULL;
+    }
+    return WindowQueue_get_extreme(self, &self->maxDeque);
+}
+
+static PySequenceMethods WindowQueue_sequence_methods = {
+    (lenfunc)WindowQueue_len,       /* sq_length */
+    0,                              /* sq_concat */
+    NULL,                           /* sq_repeat */
+    (ssizeargfunc)WindowQueue_item, /* sq_item */
+    NULL,                           /* sq_slice */
+    NULL,                           /* sq_as_item */
+    NULL,                           /* sq_as_slice */
+    NULL,                           /* sq_contains */
+    0                               /* sq_inplace_concat */
+};
+
+PyDoc_STRVAR(window_enqueue_doc,
+             "Add a number to the front of the WindowQueue, evicting the "
+             "oldest one once maxlen numbers are held.");
+static PyMethodDef WindowQueue_methods[] = {
+    {"enqueue", (PyCFunction)WindowQueue_enqueue, METH_O, window_enqueue_doc},
+    {"dequeue", (PyCFunction)WindowQueue_dequeue, METH_NOARGS, dequeue_doc},
+    {"is_empty", (PyCFunction)WindowQueue_is_empty, METH_NOARGS,
+     is_empty_doc},
+    {"extend", (PyCFunction)WindowQueue_extend, METH_O, extend_doc},
+    {"__sizeof__", (PyCFunction)WindowQueue_sizeof, METH_NOARGS, sizeof_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyMemberDef WindowQueue_members[] = {
+    {"maxlen", T_PYSSIZET, offsetof(WindowQueue_t, maxlen), READONLY,
+     "Largest number of values held by the window."},
+    {NULL}};
+
+static PyGetSetDef WindowQueue_getset[] = {
+    {"sum", (getter)WindowQueue_get_sum, NULL,
+     "Sum of the values in the window.", NULL},
+    {"mean", (getter)WindowQueue_get_mean, NULL,
+     "Mean of the values in the window, None if it is empty.", NULL},
+    {"min", (getter)WindowQueue_get_min, NULL,
+     "Smallest value in the window, None if it is empty.", NULL},
+    {"max", (getter)WindowQueue_get_max, NULL,
+     "Largest value in the window, None if it is empty.", NULL},
+    {NULL}};
+
+PyDoc_STRVAR(windowqueue_doc,
+             "WindowQueue(maxlen, aggregates=None) -> Bounded Queue of "
+             "numbers with running aggregates.");
+static PyTypeObject WindowQueueType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "WindowQueue", /* tp_name */
+    sizeof(WindowQueue_t),                        /* tp_basicsize */
+    0,                                            /* tp_itemsize */
+    (destructor)WindowQueue_dealloc,              /* tp_dealloc */
+    0,                                            /* tp_print */
+    0,                                            /* tp_getattr */
+    0,                                            /* tp_setattr */
+    0,                                            /* tp_reserved */
+    0,                                            /* tp_repr */
+    0,                                            /* tp_as_number */
+    &WindowQueue_sequence_methods,                /* tp_as_sequence */
+    0,                                            /* tp_as_mapping */
+    PyObject_HashNotImplemented,                  /* tp_hash */
+    0,                                            /* tp_call */
+    0,                                            /* tp_str */
+    PyObject_GenericGetAttr,                      /* tp_getattro */
+    0,                                            /* tp_setattro */
+    0,                                            /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                           /* tp_flags */
+    windowqueue_doc,                              /* tp_doc */
+    0,                                            /* tp_traverse */
+    0,                                            /* tp_clear */
+    0,                                            /* tp_richcompare */
+    0,                                            /* tp_weaklistoffset */
+    0,                                            /* tp_iter */
+    0,                                            /* tp_iternext */
+    WindowQueue_methods,                          /* tp_methods */
+    WindowQueue_members,                          /* tp_members */
+    WindowQueue_getset,                           /* tp_getset */
+    0,                                            /* tp_base */
+    0,                                            /* tp_dict */
+    0,                                            /* tp_descr_get */
+    0,                                            /* tp_descr_set */
+    0,                                            /* tp_dictoffset */
+    0,                                            /* tp_init */
+    PyType_GenericAlloc,                          /* tp_alloc */
+    (newfunc)WindowQueue_new,                     /* tp_new */
+    PyObject_Del,                                 /* tp_free */
+};
+
+/**
+ * Ring delivering every item to each of its subscribers
+ * --- fastqueue.BroadcastQueue ---
+ *
+ * Items are stored once however many subscribers read them. Each subscriber
+ * holds a cursor into the ring and a slot is released once the slowest
+ * cursor has passed it. The queue counts the subscribers sitting on its
+ * oldest slot, so it only looks for the new slowest cursor once that count
+ * drops to zero.
+ */
+#define LAG_BLOCK 0
+#define LAG_DROP 1
+#define LAG_DETACH 2
+
+static const char* lag_names[] = {"block", "drop", "detach"};
+
+typedef struct BroadcastSubscriber BroadcastSubscriber_t;
+
+typedef struct BroadcastQueue {
+    PyObject_HEAD PyObject** objects;
+    size_t mask;       // Capacity of the ring minus one, a power of two
+    size_t tail;       // Sequence number of the oldest item held
+    size_t front;      // Sequence number the next item gets
+    Py_ssize_t maxlen; // Bound on held items, -1 when unbounded
+    int lag;
+    BroadcastSubscriber_t** subscribers;
+    Py_ssize_t numSubscribers;
+    Py_ssize_t allocated;
+    Py_ssize_t atTail;        // Subscribers whose cursor is tail
+    PyThread_type_lock space; // Released to wake a blocked producer
+    Py_ssize_t waiters;
+    char signaled; // Whether space is released
+} BroadcastQueue_t;
+
+struct BroadcastSubscriber {
+    PyObject_HEAD BroadcastQueue_t* queue; // NULL once closed or detached
+    size_t cursor;                         // Sequence number read next
+    Py_ssize_t index;                      // Position in queue->subscribers
+    Py_ssize_t dropped;
+    char detached;
+};
+
+static PyTypeObject BroadcastQueueType;
+static PyTypeObject BroadcastSubscriberType;
+
+static void BroadcastQueue_wake(BroadcastQueue_t* self) {
+    if (self->waiters > 0 && !self->signaled) {
+        self->signaled = 1;
+        PyThread_release_lock(self->space);
+    }
+}
+
+// Wait with the GIL released until a slot is released
+static int BroadcastQueue_wait(BroadcastQueue_t* self) {
+    PyLockStatus status;
+    self->waiters++;
+    Py_BEGIN_ALLOW_THREADS
+    status = PyThread_acquire_lock_timed(self->space, -1, 1);
+    Py_END_ALLOW_THREADS
+    self->waiters--;
+    if (status == PY_LOCK_ACQUIRED) {
+        self->signaled = 0;
+        return 0;
+    }
+    return PyErr_CheckSignals();
+}
+
+// Release the slots every subscriber has passed
+static void BroadcastQueue_reclaim(BroadcastQueue_t* self) {
+    if (self->atTail > 0) {
+        return;
+    }
+
+    // Destructors run by the releases may move cursors, so the slowest
+    // cursor is looked for again until nothing is left to release
+    for (;;) {
+        size_t oldest = self->front;
+        for (Py_ssize_t i = 0; i < self->numSubscribers; ++i) {
+            if (self->subscribers[i]->cursor < oldest) {
+                oldest = self->subscribers[i]->cursor;
+            }
+        }
+        if (self->tail >= oldest) {
+            break;
+        }
+        while (self->tail < oldest) {
+            PyObject* object = self->objects[self->tail & self->mask];
+            self->tail++;
+            Py_DECREF(object);
+        }
+    }
+
+    self->atTail = 0;
+    for (Py_ssize_t i = 0; i < self->numSubscribers; ++i) {
+        self->atTail += self->subscribers[i]->cursor == self->tail;
+    }
+    BroadcastQueue_wake(self);
+}
+
+// Called once a subscriber leaves the slot at its cursor behind
+static inline void BroadcastQueue_passed(BroadcastQueue_t* self,
+                                         size_t cursor) {
+    if (cursor == self->tail && --self->atTail == 0) {
+        BroadcastQueue_reclaim(self);
+    }
+}
+
+static void BroadcastQueue_unregister(BroadcastQueue_t* self,
+                                      BroadcastSubscriber_t* subscriber) {
+    BroadcastSubscriber_t* last =
+        self->subscribers[--self->numSubscribers];
+    self->subscribers[subscriber->index] = last;
+    last->index = subscriber->index;
+    subscriber->queue = NULL;
+    BroadcastQueue_passed(self, subscriber->cursor);
+}
+
+static int BroadcastQueue_grow(BroadcastQueue_t* self) {
+    size_t capacity = (self->mask + 1) * 2;
+    PyObject** objects =
+        (PyObject**)PyMem_Malloc(capacity * sizeof(PyObject*));
+    if (objects == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (size_t seq = self->tail; seq < self->front; ++seq) {
+        objects[seq & (capacity - 1)] = self->objects[seq & self->mask];
+    }
+    PyMem_Free(self->objects);
+    self->objects = objects;
+    self->mask = capacity - 1;
+    return 0;
+}
+
+// Make room for one more item in a bounded queue that is full
+static int BroadcastQueue_make_room(BroadcastQueue_t* self) {
+    if (self->lag == LAG_BLOCK) {
+        return BroadcastQueue_wait(self);
+    }
+
+    // The slowest subscribers lose the oldest item or are cut loose
+    for (Py_ssize_t i = self->numSubscribers - 1; i >= 0; --i) {
+        BroadcastSubscriber_t* subscriber = self->subscribers[i];
+        if (subscriber->cursor != self->tail) {
+            continue;
+        }
+        if (self->lag == LAG_DROP) {
+            subscriber->cursor++;
+            subscriber->dropped++;
+        } else {
+            BroadcastSubscriber_t* last =
+                self->subscribers[--self->numSubscribers];
+            self->subscribers[i] = last;
+            last->index = i;
+            subscriber->queue = NULL;
+            subscriber->detached = 1;
+            // The caller still holds a reference to the queue
+            Py_DECREF(self);
+        }
+    }
+    self->atTail = 0;
+    BroadcastQueue_reclaim(self);
+    return 0;
+}
+
+static int BroadcastQueue_put(BroadcastQueue_t* self, PyObject* object) {
+    for (;;) {
+        // Nobody could ever read the item
+        if (self->numSubscribers == 0) {
+            return 0;
+        }
+        size_t held = self->front - self->tail;
+        if (self->maxlen >= 0 && held >= (size_t)self->maxlen) {
+            if (BroadcastQueue_make_room(self) < 0) {
+                return -1;
+            }
+        } else if (held > self->mask) {
+            if (BroadcastQueue_grow(self) < 0) {
+                return -1;
+            }
+        } else {
+            break;
+        }
+    }
+
+    Py_INCREF(object);
+    self->objects[self->front & self->mask] = object;
+    self->front++;
+    if (self->maxlen < 0 || self->front - self->tail < (size_t)self->maxlen) {
+        // Pass the wake up on to the next blocked producer
+        BroadcastQueue_wake(self);
+    }
+    return 0;
+}
+
+static PyObject* BroadcastQueue_new(PyTypeObject* type, PyObject* args,
+                                    PyObject* kwargs) {
+    static char* kwlist[] = {"maxlen", "lag", NULL};
+    PyObject* maxlenObj = Py_None;
+    const char* lagName = "block";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Os:BroadcastQueue",
+                                     kwlist, &maxlenObj, &lagName)) {
+        return NULL;
+    }
+
+    Py_ssize_t maxlen = -1;
+    if (maxlenObj != Py_None) {
+        maxlen = PyLong_AsSsize_t(maxlenObj);
+        if (maxlen == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (maxlen < 1) {
+            PyErr_SetString(PyExc_ValueError, "maxlen must be positive");
+            return NULL;
+        }
+    }
+    int lag = LAG_BLOCK;
+    while (lag <= LAG_DETACH && strcmp(lagName, lag_names[lag]) != 0) {
+        lag++;
+    }
+    if (lag > LAG_DETACH) {
+        PyErr_Format(PyExc_ValueError,
+                     "lag must be 'block', 'drop' or 'detach', not '%s'",
+                     lagName);
+        return NULL;
+    }
+
+    BroadcastQueue_t* self = (BroadcastQueue_t*)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+    self->maxlen = maxlen;
+    self->lag = lag;
+    self->mask = CHUNKMIN - 1;
+    self->objects = (PyObject**)PyMem_Malloc(CHUNKMIN * sizeof(PyObject*));
+    self->space = PyThread_allocate_lock();
+    if (self->objects == NULL || self->space == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    // Held until a producer has to be woken
+    PyThread_acquire_lock(self->space, NOWAIT_LOCK);
+    return (PyObject*)self;
+}
+
+static int BroadcastQueue_traverse(BroadcastQueue_t* self, visitproc visit,
+                                   void* arg) {
+    for (size_t seq = self->tail; seq < self->front; ++seq) {
+        Py_VISIT(self->objects[seq & self->mask]);
+    }
+    return 0;
+}
+
+// Skip every subscriber to the end and release all held items
+static int BroadcastQueue_clear(BroadcastQueue_t* self) {
+    for (Py_ssize_t i = 0; i < self->numSubscribers; ++i) {
+        self->subscribers[i]->cursor = self->front;
+    }
+    self->atTail = 0;
+    BroadcastQueue_reclaim(self);
+    return 0;
+}
+
+static void BroadcastQueue_dealloc(BroadcastQueue_t* self) {
+    PyObject_GC_UnTrack(self);
+    if (self->objects != NULL) {
+        BroadcastQueue_clear(self);
+        PyMem_Free(self->objects);
+    }
+    PyMem_Free(self->subscribers);
+    if (self->space != NULL) {
+        if (!self->signaled) {
+            PyThread_release_lock(self->space);
+        }
+        PyThread_free_lock(self->space);
+    }
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* BroadcastQueue_enqueue(BroadcastQueue_t* self,
+                                        PyObject* object) {
+    if (BroadcastQueue_put(self, object) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* BroadcastQueue_extend(BroadcastQueue_t* self,
+                                       PyObject* iterator) {
+    PyObject* iterable = PyObject_GetIter(iterator);
+    if (iterable == NULL) {
+        PyErr_Format(PyExc_TypeError, "Expected 'Iterable', got '%s'",
+                     Py_TYPE(iterator)->tp_name);
+        return NULL;
+    }
+
+    PyObject* object;
+    while ((object = PyIter_Next(iterable)) != NULL) {
+        int res = BroadcastQueue_put(self, object);
+        Py_DECREF(object);
+        if (res < 0) {
+            break;
+        }
+    }
+    Py_DECREF(iterable);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* BroadcastQueue_subscribe(BroadcastQueue_t* self,
+                                          PyObject* args) {
+    if (self->numSubscribers == self->allocated) {
+        Py_ssize_t allocated = self->allocated ? self->allocated * 2 : 4;
+        BroadcastSubscriber_t** subscribers =
+            (BroadcastSubscriber_t**)PyMem_Realloc(
+                self->subscribers,
+                allocated * sizeof(BroadcastSubscriber_t*));
+        if (subscribers == NULL) {
+            return PyErr_NoMemory();
+        }
+        self->subscribers = subscribers;
+        self->allocated = allocated;
+    }
+
+    BroadcastSubscriber_t* subscriber = PyObject_GC_New(
+        BroadcastSubscriber_t, &BroadcastSubscriberType);
+    if (subscriber == NULL) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    subscriber->queue = self;
+    subscriber->cursor = self->front;
+    subscriber->dropped = 0;
+    subscriber->detached = 0;
+    subscriber->index = self->numSubscribers;
+    self->subscribers[self->numSubscribers++] = subscriber;
+    if (subscriber->cursor == self->tail) {
+        self->atTail++;
+    }
+    PyObject_GC_Track(subscriber);
+    return (PyObject*)subscriber;
+}
+
+static PyObject* BroadcastQueue_sizeof(BroadcastQueue_t* self,
+                                       PyObject* args) {
+    return PyLong_FromSsize_t(
+        Py_TYPE(self)->tp_basicsize + (self->mask + 1) * sizeof(PyObject*) +
+        self->allocated * sizeof(BroadcastSubscriber_t*));
+}
+
+static Py_ssize_t BroadcastQueue_len(BroadcastQueue_t* self) {
+    return (Py_ssize_t)(self->front - self->tail);
+}
+
+static PyObject* BroadcastQueue_get_maxlen(BroadcastQueue_t* self,
+                                           void* closure) {
+    if (self->maxlen < 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromSsize_t(self->maxlen);
+}
+
+static PyObject* BroadcastQueue_get_lag(BroadcastQueue_t* self,
+                                        void* closure) {
+    return PyUnicode_FromString(lag_names[self->lag]);
+}
+
+static PyObject* BroadcastSubscriber_close(BroadcastSubscriber_t* self,
+                                           PyObject* args) {
+    BroadcastQueue_t* queue = self->queue;
+    if (queue != NULL) {
+        BroadcastQueue_unregister(queue, self);
+        Py_DECREF(queue);
+    }
+    Py_RETURN_NONE;
+}
+
+static int BroadcastSubscriber_traverse(BroadcastSubscriber_t* self,
+                                        visitproc visit, void* arg) {
+    Py_VISIT(self->queue);
+    return 0;
+}
+
+static int BroadcastSubscriber_clear(BroadcastSubscriber_t* self) {
+    Py_DECREF(BroadcastSubscriber_close(self, NULL));
+    return 0;
+}
+
+static void BroadcastSubscriber_dealloc(BroadcastSubscriber_t* self) {
+    PyObject_GC_UnTrack(self);
+    BroadcastSubscriber_clear(self);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* BroadcastSubscriber_dequeue(BroadcastSubscriber_t* self) {
+    BroadcastQueue_t* queue = self->queue;
+    if (queue == NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        self->detached
+                            ? "subscriber was detached for falling behind"
+                            : "dequeue from a closed subscriber");
+        return NULL;
+    }
+    if (self->cursor == queue->front) {
+        PyErr_SetString(PyExc_IndexError, "dequeue from an empty Queue");
+        return NULL;
+    }
+
+    PyObject* object = queue->objects[self->cursor & queue->mask];
+    Py_INCREF(object);
+    BroadcastQueue_passed(queue, self->cursor++);
+    return object;
+}
+
+static Py_ssize_t BroadcastSubscriber_len(BroadcastSubscriber_t* self) {
+    if (self->queue == NULL) {
+        return 0;
+    }
+    return (Py_ssize_t)(self->queue->front - self->cursor);
+}
+
+static PyObject* BroadcastSubscriber_is_empty(BroadcastSubscriber_t* self,
+                                              PyObject* args) {
+    if (BroadcastSubscriber_len(self)) {
+        Py_RETURN_FALSE;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject* BroadcastSubscriber_get_detached(BroadcastSubscriber_t* self,
+                                                  void* closure) {
+    return PyBool_FromLong(self->detached);
+}
+
+static PySequenceMethods BroadcastQueue_sequence_methods = {
+    (lenfunc)BroadcastQueue_len, /* sq_length */
+};
+
+static PySequenceMethods BroadcastSubscriber_sequence_methods = {
+    (lenfunc)BroadcastSubscriber_len, /* sq_length */
+};
+
+PyDoc_STRVAR(subscribe_doc,
+             "Return a new subscriber which receives every item enqueued from "
+             "now on.");
+PyDoc_STRVAR(broadcast_enqueue_doc,
+             "Add an item to the front of the BroadcastQueue for every "
+             "subscriber.");
+static PyMethodDef BroadcastQueue_methods[] = {
+    {"enqueue", (PyCFunction)BroadcastQueue_enqueue, METH_O,
+     broadcast_enqueue_doc},
+    {"extend", (PyCFunction)BroadcastQueue_extend, METH_O, extend_doc},
+    {"subscribe", (PyCFunction)BroadcastQueue_subscribe, METH_NOARGS,
+     subscribe_doc},
+    {"__sizeof__", (PyCFunction)BroadcastQueue_sizeof, METH_NOARGS,
+     sizeof_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyMemberDef BroadcastQueue_members[] = {
+    {"subscribers", T_PYSSIZET, offsetof(BroadcastQueue_t, numSubscribers),
+     READONLY, "Number of attached subscribers."},
+    {NULL}};
+
+static PyGetSetDef BroadcastQueue_getset[] = {
+    {"maxlen", (getter)BroadcastQueue_get_maxlen, NULL,
+     "Largest number of items held, None when unbounded.", NULL},
+    {"lag", (getter)BroadcastQueue_get_lag, NULL,
+     "What happens to the slowest subscribers of a full queue.", NULL},
+    {NULL}};
+
+PyDoc_STRVAR(close_doc, "Stop receiving items from the BroadcastQueue.");
+static PyMethodDef BroadcastSubscriber_methods[] = {
+    {"dequeue", (PyCFunction)BroadcastSubscriber_dequeue, METH_NOARGS,
+     dequeue_doc},
+    {"is_empty", (PyCFunction)BroadcastSubscriber_is_empty, METH_NOARGS,
+     is_empty_doc},
+    {"close", (PyCFunction)BroadcastSubscriber_close, METH_NOARGS, close_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyMemberDef BroadcastSubscriber_members[] = {
+    {"dropped", T_PYSSIZET, offsetof(BroadcastSubscriber_t, dropped),
+     READONLY, "Number of items skipped for falling behind."},
+    {NULL}};
+
+static PyGetSetDef BroadcastSubscriber_getset[] = {
+    {"detached", (getter)BroadcastSubscriber_get_detached, NULL,
+     "Whether the subscriber was cut loose for falling behind.", NULL},
+    {NULL}};
+
+PyDoc_STRVAR(broadcastqueue_doc,
+             "BroadcastQueue(maxlen=None, lag='block') -> Queue delivering "
+             "every item to each of its subscribers.");
+static PyTypeObject BroadcastQueueType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "BroadcastQueue", /* tp_name */
+    sizeof(BroadcastQueue_t),                        /* tp_basicsize */
+    0,                                               /* tp_itemsize */
+    (destructor)BroadcastQueue_dealloc,              /* tp_dealloc */
+    0,                                               /* tp_print */
+    0,                                               /* tp_getattr */
+    0,                                               /* tp_setattr */
+    0,                                               /* tp_reserved */
+    0,                                               /* tp_repr */
+    0,                                               /* tp_as_number */
+    &BroadcastQueue_sequence_methods,                /* tp_as_sequence */
+    0,                                               /* tp_as_mapping */
+    PyObject_HashNotImplemented,                     /* tp_hash */
+    0,                                               /* tp_call */
+    0,                                               /* tp_str */
+    PyObject_GenericGetAttr,                         /* tp_getattro */
+    0,                                               /* tp_setattro */
+    0,                                               /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,         /* tp_flags */
+    broadcastqueue_doc,                              /* tp_doc */
+    (traverseproc)BroadcastQueue_traverse,           /* tp_traverse */
+    (inquiry)BroadcastQueue_clear,                   /* tp_clear */
+    0,                                               /* tp_richcompare */
+    0,                                               /* tp_weaklistoffset */
+    0,                                               /* tp_iter */
+    0,                                               /* tp_iternext */
+    BroadcastQueue_methods,                          /* tp_methods */
+    BroadcastQueue_members,                          /* tp_members */
+    BroadcastQueue_getset,                           /* tp_getset */
+    0,                                               /* tp_base */
+    0,                                               /* tp_dict */
+    0,                                               /* tp_descr_get */
+    0,                                               /* tp_descr_set */
+    0,                                               /* tp_dictoffset */
+    0,                                               /* tp_init */
+    PyType_GenericAlloc,                             /* tp_alloc */
+    (newfunc)BroadcastQueue_new,                     /* tp_new */
+    PyObject_GC_Del,                                 /* tp_free */
+};
+
+PyDoc_STRVAR(broadcastsubscriber_doc,
+             "Cursor reading the items of a BroadcastQueue, made by "
+             "BroadcastQueue.subscribe().");
+static PyTypeObject BroadcastSubscriberType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "BroadcastSubscriber", /* tp_name */
+    sizeof(BroadcastSubscriber_t),                        /* tp_basicsize */
+    0,                                                    /* tp_itemsize */
+    (destructor)BroadcastSubscriber_dealloc,              /* tp_dealloc */
+    0,                                                    /* tp_print */
+    0,                                                    /* tp_getattr */
+    0,                                                    /* tp_setattr */
+    0,                                                    /* tp_reserved */
+    0,                                                    /* tp_repr */
+    0,                                                    /* tp_as_number */
+    &BroadcastSubscriber_sequence_methods,                /* tp_as_sequence */
+    0,                                                    /* tp_as_mapping */
+    PyObject_HashNotImplemented,                          /* tp_hash */
+    0,                                                    /* tp_call */
+    0,                                                    /* tp_str */
+    PyObject_GenericGetAttr,                              /* tp_getattro */
+    0,                                                    /* tp_setattro */
+    0,                                                    /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,              /* tp_flags */
+    broadcastsubscriber_doc,                              /* tp_doc */
+    (traverseproc)BroadcastSubscriber_traverse,           /* tp_traverse */
+    (inquiry)BroadcastSubscriber_clear,                   /* tp_clear */
+    0,                                                    /* tp_richcompare */
+    0,                                                    /* tp_weaklistoffset */
+    0,                                                    /* tp_iter */
+    0,                                                    /* tp_iternext */
+    BroadcastSubscriber_methods,                          /* tp_methods */
+    BroadcastSubscriber_members,                          /* tp_members */
+    BroadcastSubscriber_getset,                           /* tp_getset */
+    0,                                                    /* tp_base */
+    0,                                                    /* tp_dict */
+    0,                                                    /* tp_descr_get */
+    0,                                                    /* tp_descr_set */
+    0,                                                    /* tp_dictoffset */
+    0,                                                    /* tp_init */
+    0,                                                    /* tp_alloc */
+    0,                                                    /* tp_new */
+    PyObject_GC_Del,                                      /* tp_free */
+};
+
+/**
+ * Queue handing out items once their deadline has passed
+ * --- fastqueue.DelayQueue ---
+ *
+ * A hierarchical timer wheel. Time is counted in ticks of a fixed resolution
+ * and a deadline is rounded up to a tick, so items are never handed out
+ * early. Level l of the wheel has WHEEL_SLOTS slots each spanning
+ * WHEEL_SLOTS^l ticks. An item sits on the lowest level whose slots tell its
+ * tick apart from the current one and moves down a level whenever the
+ * current tick reaches its slot, so it is moved at most WHEEL_LEVELS times.
+ * A bitmap of occupied slots per level lets the wheel skip idle time in a
+ * few instructions.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+#define WHEEL_REACH ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+#ifdef _MSC_VER
+static inline int bit_highest(uint64_t x) {
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return (int)index;
+}
+static inline int bit_lowest(uint64_t x) {
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+}
+#else
+static inline int bit_highest(uint64_t x) { return 63 - __builtin_clzll(x); }
+static inline int bit_lowest(uint64_t x) { return __builtin_ctzll(x); }
+#endif
+
+// time.monotonic, the clock deadlines are read against
+static PyObject* monotonic;
+
+/**
+ * Chunk list holding (deadline, item) pairs back to back. Chunks have an even
+ * capacity so a pair never straddles two of them, and are never shared.
+ */
+typedef struct DelaySlot {
+    QueueNode_t* head; // NULL when the slot is empty
+    QueueNode_t* tail;
+} DelaySlot_t;
+
+typedef struct DelayQueue {
+    PyObject_HEAD double origin; // Clock reading of tick 0
+    double resolution;           // Seconds per tick
+    uint64_t now;                // Last tick expired
+    uint64_t occupied[WHEEL_LEVELS];
+    DelaySlot_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    DelaySlot_t overflow; // Deadlines beyond the reach of the wheel
+    uint64_t overflowMin; // Earliest tick in the overflow slot
+    DelaySlot_t spill;    // Pairs a cascade ran out of memory placing
+    DelaySlot_t ready;    // Expired pairs not handed out yet
+    Py_ssize_t numReady;
+    Py_ssize_t length;
+    Py_ssize_t gcEntries;
+    PyThread_type_lock wakeup; // Released to wake a blocked get()
+    Py_ssize_t waiters;
+    char signaled; // Whether wakeup is released
+} DelayQueue_t;
+
+static PyTypeObject DelayQueueType;
+
+// Add a pair to the end of a slot, which takes over both references
+static int DelaySlot_push(DelaySlot_t* slot, PyObject* deadline,
+                          PyObject* item) {
+    QueueNode_t* tail = slot->tail;
+    if (tail == NULL || tail->numEntries > tail->mask) {
+        Py_ssize_t capacity = tail == NULL ? CHUNKMIN : (tail->mask + 1) * 2;
+        QueueNode_t* node =
+            QueueNode_new(capacity < CHUNKLEN ? capacity : CHUNKLEN, NULL);
+        if (node == NULL) {
+            return -1;
+        }
+        if (tail == NULL) {
+            slot->head = node;
+        } else {
+            tail->next = node;
+        }
+        slot->tail = tail = node;
+    }
+    QueueNode_put(tail, deadline);
+    QueueNode_put(tail, item);
+    return 0;
+}
+
+// Drop the oldest pair of a nonempty slot, its references are taken over by
+// the caller
+static inline void DelaySlot_pop(DelaySlot_t* slot) {
+    QueueNode_t* head = slot->head;
+    head->back = (head->back + 2) & head->mask;
+    head->numEntries -= 2;
+    head->chunk->back = head->back;
+    head->chunk->numEntries -= 2;
+    if (head->numEntries == 0) {
+        slot->head = head->next;
+        if (slot->head == NULL) {
+            slot->tail = NULL;
+        }
+        QueueNode_free(head);
+    }
+}
+
+// Move every pair of src behind those of dst
+static inline void DelaySlot_splice(DelaySlot_t* dst, DelaySlot_t* src) {
+    if (src->head == NULL) {
+        return;
+    }
+    if (dst->head == NULL) {
+        dst->head = src->head;
+    } else {
+        dst->tail->next = src->head;
+    }
+    dst->tail = src->tail;
+    src->head = NULL;
+    src->tail = NULL;
+}
+
+static Py_ssize_t DelaySlot_length(DelaySlot_t* slot) {
+    Py_ssize_t numEntries = 0;
+    for (QueueNode_t* node = slot->head; node != NULL; node = node->next) {
+        numEntries += node->numEntries;
+    }
+    return numEntries / 2;
+}
+
+static int DelaySlot_traverse(DelaySlot_t* slot, visitproc visit, void* arg) {
+    for (QueueNode_t* node = slot->head; node != NULL; node = node->next) {
+        for (Py_ssize_t i = 0; i < node->numEntries; ++i) {
+            Py_VISIT(node->chunk->py_objects[(node->back + i) & node->mask]);
+        }
+    }
+    return 0;
+}
+
+static Py_ssize_t DelaySlot_sizeof(DelaySlot_t* slot) {
+    Py_ssize_t size = 0;
+    for (QueueNode_t* node = slot->head; node != NULL; node = node->next) {
+        size += sizeof(QueueNode_t) + QueueChunk_SIZE(node->mask + 1);
+    }
+    return size;
+}
+
+static int DelayQueue_clock(double* now) {
+    PyObject* reading = PyObject_CallObject(monotonic, NULL);
+    if (reading == NULL) {
+        return -1;
+    }
+    *now = PyFloat_AsDouble(reading);
+    Py_DECREF(reading);
+    return *now == -1.0 && PyErr_Occurred() ? -1 : 0;
+}
+
+// Convert a clock reading to ticks, rounding deadlines up and the current
+// time down so no item expires early
+static int DelayQueue_ticks(DelayQueue_t* self, double when, int roundUp,
+                            uint64_t* tick) {
+    double ticks = (when - self->origin) / self->resolution;
+    if (Py_IS_NAN(ticks)) {
+        PyErr_SetString(PyExc_ValueError, "time must not be NaN");
+        return -1;
+    }
+    ticks = roundUp ? ceil(ticks) : floor(ticks);
+    if (ticks >= 9.2e18) {
+        PyErr_SetString(PyExc_OverflowError, "time is too far in the future");
+        return -1;
+    }
+    *tick = ticks > 0 ? (uint64_t)ticks : 0;
+    return 0;
+}
+
+static inline uint64_t DelayQueue_deadline_tick(DelayQueue_t* self,
+                                                PyObject* deadline) {
+    uint64_t tick = 0;
+    DelayQueue_ticks(self, PyFloat_AS_DOUBLE(deadline), 1, &tick);
+    return tick;
+}
+
+static void DelayQueue_wake(DelayQueue_t* self) {
+    if (self->waiters > 0 && !self->signaled) {
+        self->signaled = 1;
+        PyThread_release_lock(self->wakeup);
+    }
+}
+
+// Add a pair to the slot its tick belongs in, which takes over both
+// references
+static int DelayQueue_place(DelayQueue_t* self, PyObject* deadline,
+                            PyObject* item) {
+    uint64_t tick = DelayQueue_deadline_tick(self, deadline);
+    if (tick <= self->now) {
+        if (DelaySlot_push(&self->ready, deadline, item) < 0) {
+            return -1;
+        }
+        self->numReady++;
+        return 0;
+    }
+
+    // The highest group of bits the tick differs from now in picks the level
+    int level = bit_highest(tick ^ self->now) / WHEEL_BITS;
+    if (level >= WHEEL_LEVELS) {
+        if (self->overflow.head == NULL || tick < self->overflowMin) {
+            self->overflowMin = tick;
+        }
+        return DelaySlot_push(&self->overflow, deadline, item);
+    }
+    int index = (int)(tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    if (DelaySlot_push(&self->wheel[level][index], deadline, item) < 0) {
+        return -1;
+    }
+    self->occupied[level] |= (uint64_t)1 << index;
+    return 0;
+}
+
+// Place every pair of a slot again relative to now, whatever is left when
+// memory runs out waits in the spill slot
+static int DelayQueue_cascade(DelayQueue_t* self, DelaySlot_t* slot) {
+    DelaySlot_t pending = *slot;
+    slot->head = NULL;
+    slot->tail = NULL;
+    while (pending.head != NULL) {
+        QueueNode_t* head = pending.head;
+        PyObject* deadline = head->chunk->py_objects[head->back];
+        PyObject* item =
+            head->chunk->py_objects[(head->back + 1) & head->mask];
+        if (DelayQueue_place(self, deadline, item) < 0) {
+            DelaySlot_splice(&self->spill, &pending);
+            PyErr_NoMemory();
+            return -1;
+        }
+        DelaySlot_pop(&pending);
+    }
+    return 0;
+}
+
+// The first tick after now at which a slot expires or cascades, or
+// UINT64_MAX when the wheel is empty
+static uint64_t DelayQueue_next_event(DelayQueue_t* self) {
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        int shift = level * WHEEL_BITS;
+        int current = (int)(self->now >> shift) & WHEEL_MASK;
+        uint64_t later = current == WHEEL_MASK
+                             ? 0
+                             : self->occupied[level] &
+                                   (~(uint64_t)0 << (current + 1));
+        if (later) {
+            uint64_t rotation = self->now >> (shift + WHEEL_BITS)
+                                                << (shift + WHEEL_BITS);
+            uint64_t tick = rotation | (uint64_t)bit_lowest(later) << shift;
+            if (tick < next) {
+                next = tick;
+            }
+        }
+    }
+    if (self->overflow.head != NULL) {
+        // The turn of the wheel reaching the earliest overflow deadline
+        uint64_t tick = self->overflowMin / WHEEL_REACH * WHEEL_REACH;
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+// Cascade the overflow and higher level slots due at tick next, when now has
+// just reached it, and move the expired level 0 slot to the ready slot
+static int DelayQueue_tick(DelayQueue_t* self, uint64_t next) {
+    if (self->overflow.head != NULL &&
+        next == self->overflowMin / WHEEL_REACH * WHEEL_REACH &&
+        DelayQueue_cascade(self, &self->overflow) < 0) {
+        return -1;
+    }
+    // Higher levels first, their pairs may land in the lower slots reached
+    // at the same tick
+    for (int level = WHEEL_LEVELS - 1; level > 0; --level) {
+        int shift = level * WHEEL_BITS;
+        if (next & (((uint64_t)1 << shift) - 1)) {
+            continue;
+        }
+        int index = (int)(next >> shift) & WHEEL_MASK;
+        if (self->occupied[level] & (uint64_t)1 << index) {
+            self->occupied[level] &= ~((uint64_t)1 << index);
+            if (DelayQueue_cascade(self, &self->wheel[level][index]) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    int index = (int)next & WHEEL_MASK;
+    if (self->occupied[0] & (uint64_t)1 << index) {
+        self->occupied[0] &= ~((uint64_t)1 << index);
+        self->numReady += DelaySlot_length(&self->wheel[0][index]);
+        DelaySlot_splice(&self->ready, &self->wheel[0][index]);
+    }
+    return 0;
+}
+
+// Move every slot still due at tick next to the spill slot. now stays at
+// next, whose slots are never looked at again, so the next advance has to
+// place these pairs again.
+static void DelayQueue_spill_due(DelayQueue_t* self, uint64_t next) {
+    if (self->overflow.head != NULL &&
+        next == self->overflowMin / WHEEL_REACH * WHEEL_REACH) {
+        DelaySlot_splice(&self->spill, &self->overflow);
+    }
+    for (int level = WHEEL_LEVELS - 1; level >= 0; --level) {
+        int shift = level * WHEEL_BITS;
+        if (next & (((uint64_t)1 << shift) - 1)) {
+            continue;
+        }
+        int index = (int)(next >> shift) & WHEEL_MASK;
+        if (self->occupied[level] & (uint64_t)1 << index) {
+            self->occupied[level] &= ~((uint64_t)1 << index);
+            DelaySlot_splice(&self->spill, &self->wheel[level][index]);
+        }
+    }
+}
+
+// Move the wheel on to target, expired pairs are moved to the ready slot.
+// When memory runs out midway every pair due at the tick reached so far is
+// left in the spill slot, which the next call places first.
+static int DelayQueue_advance(DelayQueue_t* self, uint64_t target) {
+    if (self->spill.head != NULL &&
+        DelayQueue_cascade(self, &self->spill) < 0) {
+        return -1;
+    }
+
+    while (self->now < target) {
+        uint64_t next = DelayQueue_next_event(self);
+        if (next > target) {
+            self->now = target;
+            break;
+        }
+        // Pairs are placed relative to now, so it moves on before cascading
+        self->now = next;
+        if (DelayQueue_tick(self, next) < 0) {
+            DelayQueue_spill_due(self, next);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Expire everything due at the clock reading now
+static int DelayQueue_expire(DelayQueue_t* self, double now) {
+    uint64_t target;
+    if (DelayQueue_ticks(self, now, 0, &target) < 0) {
+        return -1;
+    }
+    return DelayQueue_advance(self, target);
+}
+
+// Take the oldest ready item out of the DelayQueue
+static PyObject* DelayQueue_take(DelayQueue_t* self) {
+    QueueNode_t* head = self->ready.head;
+    PyObject* deadline = head->chunk->py_objects[head->back];
+    PyObject* item = head->chunk->py_objects[(head->back + 1) & head->mask];
+    DelaySlot_pop(&self->ready);
+    self->numReady--;
+    self->length--;
+    GC_item_removed((PyObject*)self, &self->gcEntries, item);
+    Py_DECREF(deadline);
+    return item;
+}
+
+static PyObject* DelayQueue_new(PyTypeObject* type, PyObject* args,
+                                PyObject* kwargs) {
+    static char* kwlist[] = {"resolution", NULL};
+    double resolution = 0.001;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|d:DelayQueue", kwlist,
+                                     &resolution)) {
+        return NULL;
+    }
+    if (!(resolution > 0) || Py_IS_INFINITY(resolution)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "resolution must be a positive number of seconds");
+        return NULL;
+    }
+
+    double origin;
+    if (DelayQueue_clock(&origin) < 0) {
+        return NULL;
+    }
+    DelayQueue_t* self = (DelayQueue_t*)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+    self->origin = origin;
+    self->resolution = resolution;
+    self->wakeup = PyThread_allocate_lock();
+    if (self->wakeup == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    // Held until a blocked get() has to be woken
+    PyThread_acquire_lock(self->wakeup, NOWAIT_LOCK);
+    PyObject_GC_UnTrack(self);
+    return (PyObject*)self;
+}
+
+static int DelayQueue_traverse(DelayQueue_t* self, visitproc visit,
+                               void* arg) {
+    DelaySlot_t* slots = &self->wheel[0][0];
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; ++i) {
+        int err = DelaySlot_traverse(&slots[i], visit, arg);
+        if (err) {
+            return err;
+        }
+    }
+    int err = DelaySlot_traverse(&self->overflow, visit, arg);
+    if (!err) {
+        err = DelaySlot_traverse(&self->spill, visit, arg);
+    }
+    if (!err) {
+        err = DelaySlot_traverse(&self->ready, visit, arg);
+    }
+    return err;
+}
+
+static int DelayQueue_clear(DelayQueue_t* self) {
+    // Unlink everything first, releasing the items may run code using the
+    // DelayQueue
+    DelaySlot_t held = {NULL, NULL};
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        for (int index = 0; index < WHEEL_SLOTS; ++index) {
+            DelaySlot_splice(&held, &self->wheel[level][index]);
+        }
+        self->occupied[level] = 0;
+    }
+    DelaySlot_splice(&held, &self->overflow);
+    DelaySlot_splice(&held, &self->spill);
+    DelaySlot_splice(&held, &self->ready);
+    self->numReady = 0;
+    self->length = 0;
+    self->gcEntries = 0;
+    QueueNode_free_all(held.head);
+    return 0;
+}
+
+static void DelayQueue_dealloc(DelayQueue_t* self) {
+    PyObject_GC_UnTrack(self);
+    DelayQueue_clear(self);
+    if (self->wakeup != NULL) {
+        if (!self->signaled) {
+            PyThread_release_lock(self->wakeup);
+        }
+        PyThread_free_lock(self->wakeup);
+    }
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* DelayQueue_put(DelayQueue_t* self, double when,
+                                PyObject* item) {
+    uint64_t tick;
+    if (DelayQueue_ticks(self, when, 1, &tick) < 0) {
+        return NULL;
+    }
+    PyObject* deadline = PyFloat_FromDouble(when);
+    if (deadline == NULL) {
+        return NULL;
+    }
+    Py_INCREF(item);
+    if (DelayQueue_place(self, deadline, item) < 0) {
+        Py_DECREF(deadline);
+        Py_DECREF(item);
+        return PyErr_NoMemory();
+    }
+    self->length++;
+    GC_item_added((PyObject*)self, &self->gcEntries, item);
+    DelayQueue_wake(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject* DelayQueue_enqueue_at(DelayQueue_t* self, PyObject* args) {
+    double deadline;
+    PyObject* item;
+    if (!PyArg_ParseTuple(args, "dO:enqueue_at", &deadline, &item)) {
+        return NULL;
+    }
+    return DelayQueue_put(self, deadline, item);
+}
+
+static PyObject* DelayQueue_enqueue_after(DelayQueue_t* self,
+                                          PyObject* args) {
+    double delay, now;
+    PyObject* item;
+    if (!PyArg_ParseTuple(args, "dO:enqueue_after", &delay, &item) ||
+        DelayQueue_clock(&now) < 0) {
+        return NULL;
+    }
+    return DelayQueue_put(self, now + delay, item);
+}
+
+static PyObject* DelayQueue_pop_ready(DelayQueue_t* self, PyObject* args) {
+    PyObject* when = Py_None;
+    if (!PyArg_ParseTuple(args, "|O:pop_ready", &when)) {
+        return NULL;
+    }
+    double now;
+    if (when == Py_None) {
+        if (DelayQueue_clock(&now) < 0) {
+            return NULL;
+        }
+    } else {
+        now = PyFloat_AsDouble(when);
+        if (now == -1.0 && PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+    if (DelayQueue_expire(self, now) < 0) {
+        return NULL;
+    }
+
+    PyObject* items = PyList_New(self->numReady);
+    if (items == NULL) {
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; self->ready.head != NULL; ++i) {
+        PyList_SET_ITEM(items, i, DelayQueue_take(self));
+    }
+    return items;
+}
+
+// Wait with the GIL released until an item is ready or the clock reaches end
+static PyObject* DelayQueue_wait(DelayQueue_t* self, double now, double end) {
+    for (;;) {
+        if (DelayQueue_expire(self, now) < 0) {
+            return NULL;
+        }
+        if (self->ready.head != NULL) {
+            return DelayQueue_take(self);
+        }
+
+        uint64_t next = DelayQueue_next_event(self);
+        double wakeAt =
+            next == UINT64_MAX ? end : self->origin + next * self->resolution;
+        if (wakeAt > end) {
+            wakeAt = end;
+        }
+        if (now >= end) {
+            Py_RETURN_NONE;
+        }
+
+        // Sleep until the next slot is due, an enqueue wakes us earlier
+        PY_TIMEOUT_T micros = -1;
+        if (wakeAt < Py_HUGE_VAL) {
+            double wait = ceil((wakeAt - now) * 1e6);
+            micros = wait < 1 ? 1
+                     : wait > (double)PY_TIMEOUT_MAX ? PY_TIMEOUT_MAX
+                                                     : (PY_TIMEOUT_T)wait;
+        }
+        PyLockStatus status;
+        self->waiters++;
+        Py_BEGIN_ALLOW_THREADS
+        status = PyThread_acquire_lock_timed(self->wakeup, micros, 1);
+        Py_END_ALLOW_THREADS
+        self->waiters--;
+        if (status == PY_LOCK_ACQUIRED) {
+            self->signaled = 0;
+        } else if (status == PY_LOCK_INTR && PyErr_CheckSignals() < 0) {
+            return NULL;
+        }
+        if (DelayQueue_clock(&now) < 0) {
+            return NULL;
+        }
+    }
+}
+
+static PyObject* DelayQueue_get(DelayQueue_t* self, PyObject* args,
+                                PyObject* kwargs) {
+    static char* kwlist[] = {"timeout", NULL};
+    PyObject* timeout = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:get", kwlist,
+                                     &timeout)) {
+        return NULL;
+    }
+    double now, end = Py_HUGE_VAL;
+    if (DelayQueue_clock(&now) < 0) {
+        return NULL;
+    }
+    if (timeout != Py_None) {
+        double seconds = PyFloat_AsDouble(timeout);
+        if (seconds == -1.0 && PyErr_Occurred()) {
+            return NULL;
+        }
+        end = now + seconds;
+    }
+
+    PyObject* item = DelayQueue_wait(self, now, end);
+    // Whoever waits on is left to watch for the next deadline
+    if (self->length > 0) {
+        DelayQueue_wake(self);
+    }
+    return item;
+}
+
+static PyObject* DelayQueue_is_empty(DelayQueue_t* self, PyObject* args) {
+    if (self->length) {
+        Py_RETURN_FALSE;
+    }
+    Py_RETURN_TRUE;
+}
+
+static Py_ssize_t DelayQueue_len(DelayQueue_t* self) { return self->length; }
+
+static PyObject* DelayQueue_sizeof(DelayQueue_t* self, PyObject* args) {
+    Py_ssize_t size = Py_TYPE(self)->tp_basicsize;
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        uint64_t occupied = self->occupied[level];
+        while (occupied) {
+            size += DelaySlot_sizeof(&self->wheel[level][bit_lowest(occupied)]);
+            occupied &= occupied - 1;
+        }
+    }
+    size += DelaySlot_sizeof(&self->overflow) +
+            DelaySlot_sizeof(&self->spill) + DelaySlot_sizeof(&self->ready);
+    return PyLong_FromSsize_t(size);
+}
+
+static PySequenceMethods DelayQueue_sequence_methods = {
+    (lenfunc)DelayQueue_len, /* sq_length */
+};
+
+PyDoc_STRVAR(enqueue_at_doc,
+             "Add an item to be handed out once time.monotonic() reaches "
+             "deadline.");
+PyDoc_STRVAR(enqueue_after_doc,
+             "Add an item to be handed out delay seconds from now.");
+PyDoc_STRVAR(pop_ready_doc,
+             "Remove and return a list of every item whose deadline has "
+             "passed at now, which defaults to time.monotonic().");
+PyDoc_STRVAR(delay_get_doc,
+             "Remove and return the next item once its deadline passes, "
+             "None if timeout seconds pass first.");
+static PyMethodDef DelayQueue_methods[] = {
+    {"enqueue_at", (PyCFunction)DelayQueue_enqueue_at, METH_VARARGS,
+     enqueue_at_doc},
+    {"enqueue_after", (PyCFunction)DelayQueue_enqueue_after, METH_VARARGS,
+     enqueue_after_doc},
+    {"pop_ready", (PyCFunction)DelayQueue_pop_ready, METH_VARARGS,
+     pop_ready_doc},
+    {"get", (PyCFunction)(void (*)(void))DelayQueue_get,
+     METH_VARARGS | METH_KEYWORDS, delay_get_doc},
+    {"is_empty", (PyCFunction)DelayQueue_is_empty, METH_NOARGS, is_empty_doc},
+    {"__sizeof__", (PyCFunction)DelayQueue_sizeof, METH_NOARGS, sizeof_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyMemberDef DelayQueue_members[] = {
+    {"resolution", T_DOUBLE, offsetof(DelayQueue_t, resolution), READONLY,
+     "Seconds per tick, deadlines are rounded up to a whole tick."},
+    {NULL}};
+
+PyDoc_STRVAR(delayqueue_doc,
+             "DelayQueue(resolution=0.001) -> Queue handing out items once "
+             "their deadline has passed.");
+static PyTypeObject DelayQueueType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "DelayQueue", /* tp_name */
+    sizeof(DelayQueue_t),                        /* tp_basicsize */
+    0,                                           /* tp_itemsize */
+    (destructor)DelayQueue_dealloc,              /* tp_dealloc */
+    0,                                           /* tp_print */
+    0,                                           /* tp_getattr */
+    0,                                           /* tp_setattr */
+    0,                                           /* tp_reserved */
+    0,                                           /* tp_repr */
+    0,                                           /* tp_as_number */
+    &DelayQueue_sequence_methods,                /* tp_as_sequence */
+    0,                                           /* tp_as_mapping */
+    PyObject_HashNotImplemented,                 /* tp_hash */
+    0,                                           /* tp_call */
+    0,                                           /* tp_str */
+    PyObject_GenericGetAttr,                     /* tp_getattro */
+    0,                                           /* tp_setattro */
+    0,                                           /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    delayqueue_doc,                              /* tp_doc */
+    (traverseproc)DelayQueue_traverse,           /* tp_traverse */
+    (inquiry)DelayQueue_clear,                   /* tp_clear */
+    0,                                           /* tp_richcompare */
+    0,                                           /* tp_weaklistoffset */
+    0,                                           /* tp_iter */
+    0,                                           /* tp_iternext */
+    DelayQueue_methods,                          /* tp_methods */
+    DelayQueue_members,                          /* tp_members */
+    0,                                           /* tp_getset */
+    0,                                           /* tp_base */
+    0,                                           /* tp_dict */
+    0,                                           /* tp_descr_get */
+    0,                                           /* tp_descr_set */
+    0,                                           /* tp_dictoffset */
+    0,                                           /* tp_init */
+    PyType_GenericAlloc,                         /* tp_alloc */
+    (newfunc)DelayQueue_new,                     /* tp_new */
+    PyObject_GC_Del,                             /* tp_free */
+};
+
+/**
+ * Set of work-stealing deques for thread pool schedulers
+ * --- fastqueue.WorkStealingPool ---
+ *
+ * Every worker owns a Chase-Lev deque. The owner pushes and pops tasks at
+ * the bottom without locking, idle workers steal the oldest tasks from the
+ * top of a random victim with a CAS, so workers only contend when one of
+ * them runs dry. Tasks submitted from outside the workers go through a
+ * shared LockQueue, which workers drain in batches.
+ *
+ * Chase and Lev, "Dynamic Circular Work-Stealing Deque", SPAA 2005, with the
+ * fences of Le et al., "Correct and Efficient Work-Stealing for Weak Memory
+ * Models", PPoPP 2013.
+ */
+#define WORKPOOL_BATCH 32
+
+typedef struct WorkBuffer {
+    Py_ssize_t mask;            // Capacity minus one, a power of two
+    struct WorkBuffer* retired; // Smaller buffer thieves may still read
+    PyObject* volatile tasks[1];
+} WorkBuffer_t;
+
+typedef struct WorkDeque {
+    volatile Py_ssize_t top; // Index of the oldest task, only ever grows
+    // Keep the end thieves write off the line the owner writes
+    char pad[64 - sizeof(Py_ssize_t)];
+    volatile Py_ssize_t bottom; // Index the owner pushes to next
+    WorkBuffer_t* volatile buffer;
+    uint64_t seed; // Picks victims, only used by the owner
+    char pad2[64 - sizeof(Py_ssize_t) - sizeof(WorkBuffer_t*) -
+              sizeof(uint64_t)];
+} WorkDeque_t;
+
+typedef struct WorkStealingPool {
+    PyObject_HEAD WorkDeque_t* deques;
+    Py_ssize_t numWorkers;
+    Py_ssize_t batch;      // Most tasks moved by one steal or drain
+    LockQueue_t* injector; // Tasks submitted from outside the workers
+} WorkStealingPool_t;
+
+static PyTypeObject WorkStealingPoolType;
+
+static WorkBuffer_t* WorkBuffer_new(Py_ssize_t capacity) {
+    WorkBuffer_t* buffer = (WorkBuffer_t*)PyMem_Malloc(
+        offsetof(WorkBuffer_t, tasks) + capacity * sizeof(PyObject*));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer->mask = capacity - 1;
+    buffer->retired = NULL;
+    return buffer;
+}
+
+static inline Py_ssize_t WorkDeque_size(WorkDeque_t* deque) {
+    Py_ssize_t size =
+        atomic_load_ssize(&deque->bottom) - atomic_load_ssize(&deque->top);
+    return size > 0 ? size : 0;
+}
+
+// Grow the buffer of a deque until count more tasks fit, owner only. The old
+// buffer is kept, a thief may be reading from it
+static int WorkDeque_reserve(WorkDeque_t* deque, Py_ssize_t count) {
+    WorkBuffer_t* buffer = deque->buffer;
+    Py_ssize_t top = atomic_load_ssize(&deque->top);
+    Py_ssize_t bottom = deque->bottom;
+    Py_ssize_t capacity = buffer->mask + 1;
+    while (bottom - top + count > capacity) {
+        capacity *= 2;
+    }
+    if (capacity == buffer->mask + 1) {
+        return 0;
+    }
+
+    WorkBuffer_t* grown = WorkBuffer_new(capacity);
+    if (grown == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (Py_ssize_t i = top; i < bottom; ++i) {
+        grown->tasks[i & grown->mask] = buffer->tasks[i & buffer->mask];
+    }
+    grown->retired = buffer;
+    atomic_store_ptr((void* volatile*)&deque->buffer, grown);
+    return 0;
+}
+
+// Push a task at the bottom, the deque takes over the reference. Owner only
+static inline int WorkDeque_push(WorkDeque_t* deque, PyObject* task) {
+    if (WorkDeque_reserve(deque, 1) < 0) {
+        return -1;
+    }
+    WorkBuffer_t* buffer = deque->buffer;
+    Py_ssize_t bottom = deque->bottom;
+    buffer->tasks[bottom & buffer->mask] = task;
+    // Publishes the task to thieves
+    atomic_store_ssize(&deque->bottom, bottom + 1);
+    return 0;
+}
+
+// Pop the newest task, NULL when empty. Owner only
+static PyObject* WorkDeque_pop(WorkDeque_t* deque) {
+    Py_ssize_t bottom = deque->bottom - 1;
+    WorkBuffer_t* buffer = deque->buffer;
+    atomic_store_ssize(&deque->bottom, bottom);
+    atomic_fence();
+    Py_ssize_t top = atomic_load_ssize(&deque->top);
+
+    PyObject* task = NULL;
+    if (top <= bottom) {
+        task = buffer->tasks[bottom & buffer->mask];
+        if (top < bottom) {
+            return task;
+        }
+        // The last task, thieves may be after it too
+        if (!atomic_cas_ssize(&deque->top, top, top + 1)) {
+            task = NULL;
+        }
+    }
+    atomic_store_ssize(&deque->bottom, bottom + 1);
+    return task;
+}
+
+// Steal the oldest task, NULL when empty or when another thief took it
+// first, which sets lost
+static PyObject* WorkDeque_steal(WorkDeque_t* deque, int* lost) {
+    Py_ssize_t top = atomic_load_ssize(&deque->top);
+    atomic_fence();
+    Py_ssize_t bottom = atomic_load_ssize(&deque->bottom);
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    WorkBuffer_t* buffer =
+        (WorkBuffer_t*)atomic_load_ptr((void* volatile*)&deque->buffer);
+    PyObject* task = buffer->tasks[top & buffer->mask];
+    if (!atomic_cas_ssize(&deque->top, top, top + 1)) {
+        *lost = 1;
+        return NULL;
+    }
+    return task;
+}
+
+static inline uint64_t WorkDeque_random(WorkDeque_t* deque) {
+    // xorshift64
+    uint64_t x = deque->seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    deque->seed = x;
+    return x;
+}
+
+// Steal up to batch tasks, but no more than half of what the victim holds,
+// from the first random victim with work. The first one is returned and the
+// rest are pushed onto the deque of the thief
+static PyObject* WorkStealingPool_steal_batch(WorkStealingPool_t* self,
+                                              Py_ssize_t worker,
+                                              Py_ssize_t batch) {
+    WorkDeque_t* own = &self->deques[worker];
+    Py_ssize_t others = self->numWorkers - 1;
+    if (others == 0) {
+        return NULL;
+    }
+
+    Py_ssize_t start = (Py_ssize_t)(WorkDeque_random(own) % others);
+    for (Py_ssize_t i = 0; i < others; ++i) {
+        Py_ssize_t victimIndex = (start + i) % others;
+        WorkDeque_t* victim =
+            &self->deques[victimIndex < worker ? victimIndex : victimIndex + 1];
+
+        PyObject* task;
+        int lost;
+        do {
+            lost = 0;
+            task = WorkDeque_steal(victim, &lost);
+        } while (task == NULL && lost);
+        if (task == NULL) {
+            continue;
+        }
+
+        Py_ssize_t extra = (WorkDeque_size(victim) + 1) / 2;
+        if (extra > batch - 1) {
+            extra = batch - 1;
+        }
+        // Room is made first so no stolen task is left without a home, a
+        // thief short of memory settles for the one task
+        if (extra > 0 && WorkDeque_reserve(own, extra) < 0) {
+            PyErr_Clear();
+            extra = 0;
+        }
+        while (extra-- > 0) {
+            lost = 0;
+            PyObject* more = WorkDeque_steal(victim, &lost);
+            if (more == NULL) {
+                break;
+            }
+            WorkDeque_push(own, more);
+        }
+        return task;
+    }
+    return NULL;
+}
+
+// Move a batch of submitted tasks onto the deque of a worker and return the
+// oldest, NULL when none were submitted
+static PyObject* WorkStealingPool_drain(WorkStealingPool_t* self,
+                                        Py_ssize_t worker) {
+    WorkDeque_t* own = &self->deques[worker];
+    if (Queue_len(self->injector->queue) == 0) {
+        return NULL;
+    }
+    if (WorkDeque_reserve(own, self->batch - 1) < 0) {
+        return NULL;
+    }
+
+    LockQueue_acquire(self->injector);
+    Queue_t* queue = self->injector->queue;
+    // Leave some for the other workers
+    Py_ssize_t count = queue->length / self->numWorkers + 1;
+    if (count > self->batch) {
+        count = self->batch;
+    }
+    if (count > queue->length) {
+        count = queue->length;
+    }
+    PyObject* task = count > 0 ? Queue_dequeue(queue) : NULL;
+    while (--count > 0) {
+        WorkDeque_push(own, Queue_dequeue(queue));
+    }
+    LockQueue_release(self->injector);
+    return task;
+}
+
+static int WorkStealingPool_worker(WorkStealingPool_t* self, PyObject* arg,
+                                   Py_ssize_t* worker) {
+    *worker = PyNumber_AsSsize_t(arg, PyExc_IndexError);
+    if (*worker == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (*worker < 0 || *worker >= self->numWorkers) {
+        PyErr_SetString(PyExc_IndexError, "worker index out of range");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject* WorkStealingPool_new(PyTypeObject* type, PyObject* args,
+                                      PyObject* kwargs) {
+    static char* kwlist[] = {"workers", "batch", NULL};
+    Py_ssize_t workers, batch = WORKPOOL_BATCH;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|n:WorkStealingPool",
+                                     kwlist, &workers, &batch)) {
+        return NULL;
+    }
+    if (workers < 1) {
+        PyErr_SetString(PyExc_ValueError, "workers must be positive");
+        return NULL;
+    }
+    if (batch < 1) {
+        PyErr_SetString(PyExc_ValueError, "batch must be positive");
+        return NULL;
+    }
+
+    WorkStealingPool_t* self = (WorkStealingPool_t*)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return PyErr_NoMemory();
+    }
+    self->batch = batch;
+    self->injector =
+        (LockQueue_t*)LockQueue_new(&LockQueueType, NULL, NULL);
+    if (self->injector == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->deques =
+        (WorkDeque_t*)PyMem_Calloc(workers, sizeof(WorkDeque_t));
+    if (self->deques == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < workers; ++i) {
+        self->deques[i].buffer = WorkBuffer_new(CHUNKMIN);
+        if (self->deques[i].buffer == NULL) {
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
+        // Distinct nonzero seeds, spread by the golden ratio
+        self->deques[i].seed = (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ull;
+        self->numWorkers++;
+    }
+    return (PyObject*)self;
+}
+
+static int WorkStealingPool_traverse(WorkStealingPool_t* self,
+                                     visitproc visit, void* arg) {
+    for (Py_ssize_t i = 0; i < self->numWorkers; ++i) {
+        WorkDeque_t* deque = &self->deques[i];
+        WorkBuffer_t* buffer = deque->buffer;
+        for (Py_ssize_t j = deque->top; j < deque->bottom; ++j) {
+            Py_VISIT(buffer->tasks[j & buffer->mask]);
+        }
+    }
+    Py_VISIT(self->injector);
+    return 0;
+}
+
+static int WorkStealingPool_clear(WorkStealingPool_t* self) {
+    for (Py_ssize_t i = 0; i < self->numWorkers; ++i) {
+        PyObject* task;
+        while ((task = WorkDeque_pop(&self->deques[i])) != NULL) {
+            Py_DECREF(task);
+        }
+    }
+    if (self->injector != NULL) {
+        LockQueue_clear(self->injector);
+    }
+    return 0;
+}
+
+static void WorkStealingPool_dealloc(WorkStealingPool_t* self) {
+    PyObject_GC_UnTrack(self);
+    WorkStealingPool_clear(self);
+    for (Py_ssize_t i = 0; i < self->numWorkers; ++i) {
+        WorkBuffer_t* buffer = self->deques[i].buffer;
+        while (buffer != NULL) {
+            WorkBuffer_t* retired = buffer->retired;
+            PyMem_Free(buffer);
+            buffer = retired;
+        }
+    }
+    PyMem_Free(self->deques);
+    Py_XDECREF(self->injector);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* WorkStealingPool_submit(WorkStealingPool_t* self,
+                                         PyObject* task) {
+    return LockQueue_enqueue(self->injector, task);
+}
+
+static PyObject* WorkStealingPool_push(WorkStealingPool_t* self,
+                                       PyObject* args) {
+    PyObject *workerArg, *task;
+    Py_ssize_t worker;
+    if (!PyArg_UnpackTuple(args, "push", 2, 2, &workerArg, &task) ||
+        WorkStealingPool_worker(self, workerArg, &worker) < 0) {
+        return NULL;
+    }
+    Py_INCREF(task);
+    if (WorkDeque_push(&self->deques[worker], task) < 0) {
+        Py_DECREF(task);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* WorkStealingPool_pop(WorkStealingPool_t* self,
+                                      PyObject* workerArg) {
+    Py_ssize_t worker;
+    if (WorkStealingPool_worker(self, workerArg, &worker) < 0) {
+        return NULL;
+    }
+    PyObject* task = WorkDeque_pop(&self->deques[worker]);
+    if (task == NULL) {
+        Py_RETURN_NONE;
+    }
+    return task;
+}
+
+static PyObject* WorkStealingPool_steal(WorkStealingPool_t* self,
+                                        PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"worker", "batch", NULL};
+    PyObject* workerArg;
+    Py_ssize_t worker, batch = self->batch;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n:steal", kwlist,
+                                     &workerArg, &batch) ||
+        WorkStealingPool_worker(self, workerArg, &worker) < 0) {
+        return NULL;
+    }
+    if (batch < 1) {
+        PyErr_SetString(PyExc_ValueError, "batch must be positive");
+        return NULL;
+    }
+    PyObject* task = WorkStealingPool_steal_batch(self, worker, batch);
+    if (task == NULL) {
+        Py_RETURN_NONE;
+    }
+    return task;
+}
+
+static PyObject* WorkStealingPool_get(WorkStealingPool_t* self,
+                                      PyObject* workerArg) {
+    Py_ssize_t worker;
+    if (WorkStealingPool_worker(self, workerArg, &worker) < 0) {
+        return NULL;
+    }
+    PyObject* task = WorkDeque_pop(&self->deques[worker]);
+    if (task == NULL) {
+        task = WorkStealingPool_drain(self, worker);
+    }
+    if (task == NULL && !PyErr_Occurred()) {
+        task = WorkStealingPool_steal_batch(self, worker, self->batch);
+    }
+    if (task == NULL) {
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+    return task;
+}
+
+static Py_ssize_t WorkStealingPool_len(WorkStealingPool_t* self) {
+    Py_ssize_t length = Queue_len(self->injector->queue);
+    for (Py_ssize_t i = 0; i < self->numWorkers; ++i) {
+        length += WorkDeque_size(&self->deques[i]);
+    }
+    return length;
+}
+
+static PyObject* WorkStealingPool_is_empty(WorkStealingPool_t* self,
+                                           PyObject* args) {
+    if (WorkStealingPool_len(self)) {
+        Py_RETURN_FALSE;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject* WorkStealingPool_sizeof(WorkStealingPool_t* self,
+                                         PyObject* args) {
+    Py_ssize_t size = Py_TYPE(self)->tp_basicsize +
+                      self->numWorkers * sizeof(WorkDeque_t);
+    for (Py_ssize_t i = 0; i < self->numWorkers; ++i) {
+        WorkBuffer_t* buffer = self->deques[i].buffer;
+        for (; buffer != NULL; buffer = buffer->retired) {
+            size += offsetof(WorkBuffer_t, tasks) +
+                    (buffer->mask + 1) * sizeof(PyObject*);
+        }
+    }
+    return PyLong_FromSsize_t(size);
+}
+
+static PySequenceMethods WorkStealingPool_sequence_methods = {
+    (lenfunc)WorkStealingPool_len, /* sq_length */
+};
+
+PyDoc_STRVAR(submit_doc,
+             "Add a task from outside the workers, any worker may run it.");
+PyDoc_STRVAR(push_doc,
+             "Add a task to the deque of a worker, only call this from that "
+             "worker.");
+PyDoc_STRVAR(pop_doc,
+             "Remove and return the newest task of a worker, None if it has "
+             "none. Only call this from that worker.");
+PyDoc_STRVAR(steal_doc,
+             "Take the oldest tasks of a random other worker, up to batch but "
+             "at most half of them. Returns one and keeps the rest, None if "
+             "no worker has any.");
+PyDoc_STRVAR(pool_get_doc,
+             "Return the next task for a worker from its own deque, then the "
+             "submitted tasks, then by stealing. None if there is none.");
+static PyMethodDef WorkStealingPool_methods[] = {
+    {"submit", (PyCFunction)WorkStealingPool_submit, METH_O, submit_doc},
+    {"push", (PyCFunction)WorkStealingPool_push, METH_VARARGS, push_doc},
+    {"pop", (PyCFunction)WorkStealingPool_pop, METH_O, pop_doc},
+    {"steal", (PyCFunction)(void (*)(void))WorkStealingPool_steal,
+     METH_VARARGS | METH_KEYWORDS, steal_doc},
+    {"get", (PyCFunction)WorkStealingPool_get, METH_O, pool_get_doc},
+    {"is_empty", (PyCFunction)WorkStealingPool_is_empty, METH_NOARGS,
+     is_empty_doc},
+    {"__sizeof__", (PyCFunction)WorkStealingPool_sizeof, METH_NOARGS,
+     sizeof_doc},
+    {NULL, NULL, 0, NULL}};
+
+static PyMemberDef WorkStealingPool_members[] = {
+    {"workers", T_PYSSIZET, offsetof(WorkStealingPool_t, numWorkers),
+     READONLY, "Number of worker deques."},
+    {"batch", T_PYSSIZET, offsetof(WorkStealingPool_t, batch), READONLY,
+     "Most tasks moved to a worker by one steal or drain."},
+    {NULL}};
+
+PyDoc_STRVAR(workstealingpool_doc,
+             "WorkStealingPool(workers, batch=32) -> Work-stealing deques for "
+             "a thread pool, one per worker.");
+static PyTypeObject WorkStealingPoolType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "WorkStealingPool", /* tp_name */
+    sizeof(WorkStealingPool_t),                        /* tp_basicsize */
+    0,                                                 /* tp_itemsize */
+    (destructor)WorkStealingPool_dealloc,              /* tp_dealloc */
+    0,                                                 /* tp_print */
+    0,                                                 /* tp_getattr */
+    0,                                                 /* tp_setattr */
+    0,                                                 /* tp_reserved */
+    0,                                                 /* tp_repr */
+    0,                                                 /* tp_as_number */
+    &WorkStealingPool_sequence_methods,                /* tp_as_sequence */
+    0,                                                 /* tp_as_mapping */
+    PyObject_HashNotImplemented,                       /* tp_hash */
+    0,                                                 /* tp_call */
+    0,                                                 /* tp_str */
+    PyObject_GenericGetAttr,                           /* tp_getattro */
+    0,                                                 /* tp_setattro */
+    0,                                                 /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,           /* tp_flags */
+    workstealingpool_doc,                              /* tp_doc */
+    (traverseproc)WorkStealingPool_traverse,           /* tp_traverse */
+    (inquiry)WorkStealingPool_clear,                   /* tp_clear */
+    0,                                                 /* tp_richcompare */
+    0,                                                 /* tp_weaklistoffset */
+    0,                                                 /* tp_iter */
+    0,                                                 /* tp_iternext */
+    WorkStealingPool_methods,                          /* tp_methods */
+    WorkStealingPool_members,                          /* tp_members */
+    0,                                                 /* tp_getset */
+    0,                                                 /* tp_base */
+    0,                                                 /* tp_dict */
+    0,                                                 /* tp_descr_get */
+    0,                                                 /* tp_descr_set */
+    0,                                                 /* tp_dictoffset */
+    0,                                                 /* tp_init */
+    PyType_GenericAlloc,                               /* tp_alloc */
+    (newfunc)WorkStealingPool_new,                     /* tp_new */
+    PyObject_GC_Del,                                   /* tp_free */
+};
+
+PyDoc_STRVAR(fastqueue_doc,
+             "Single ended fast queue's built in C tuned for python.");
+static PyModuleDef QueueModuleDef = {PyModuleDef_HEAD_INIT,
+                                     "_fastqueue",
+                                     fastqueue_doc,
+                                     -1,
+                                     NULL,
+                                     NULL,
+                                     NULL,
+                                     NULL,
+                                     NULL};
+
+PyMODINIT_FUNC PyInit__fastqueue(void) {
+    PyObject* module;
+    if (PyType_Ready(&QueueType) < 0 || PyType_Ready(&QueueCType) < 0 ||
+        PyType_Ready(&LockQueueType) < 0 ||
+        PyType_Ready(&IndexedQueueType) < 0 ||
+        PyType_Ready(&WindowQueueType) < 0 ||
+        PyType_Ready(&BroadcastQueueType) < 0 ||
+        PyType_Ready(&BroadcastSubscriberType) < 0 ||
+        PyType_Ready(&DelayQueueType) < 0 ||
+        PyType_Ready(&WorkStealingPoolType) < 0 ||
+        PyType_Ready(&SharedChunkType) < 0) {
+        return NULL;
+    }
+
+    PyObject* time = PyImport_ImportModule("time");
+    if (time == NULL) {
+        return NULL;
+    }
+    monotonic = PyObject_GetAttrString(time, "monotonic");
+    Py_DECREF(time);
+    if (monotonic == NULL) {
         return NULL;
     }
 
@@ -847,5 +5347,14 @@ PyMODINIT_FUNC PyInit__fastqueue(void) {
     PyModule_AddObject(module, "QueueC", (PyObject*)&QueueCType);
     PyModule_AddObject(module, "Queue", (PyObject*)&QueueType);
     PyModule_AddObject(module, "LockQueue", (PyObject*)&LockQueueType);
+    PyModule_AddObject(module, "IndexedQueue", (PyObject*)&IndexedQueueType);
+    PyModule_AddObject(module, "WindowQueue", (PyObject*)&WindowQueueType);
+    PyModule_AddObject(module, "BroadcastQueue",
+                       (PyObject*)&BroadcastQueueType);
+    PyModule_AddObject(module, "BroadcastSubscriber",
+                       (PyObject*)&BroadcastSubscriberType);
+    PyModule_AddObject(module, "DelayQueue", (PyObject*)&DelayQueueType);
+    PyModule_AddObject(module, "WorkStealingPool",
+                       (PyObject*)&WorkStealingPoolType);
     return module;
 }
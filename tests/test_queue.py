@@ -1,3 +1,8 @@
+import gc
+import sys
+import threading
+import time
+import weakref
 import pytest
 
 from fastqueue.prototypes import *
@@ -7,7 +12,9 @@ queue_size = 350000
 
 
 @pytest.mark.parametrize(
-    "queue", [LockQueue(), Queue(), QueueC(), LLQueue(), ContQueue()]
+    "queue",
+    [LockQueue(), LockQueue(combining=True), Queue(), QueueC(), LLQueue(),
+     ContQueue()],
 )
 def test_new(queue):
     assert queue.is_empty()
@@ -32,7 +39,9 @@ def test_new(queue):
 
 
 @pytest.mark.parametrize(
-    "queue", [LockQueue(), Queue(), QueueC(), LLQueue(), ContQueue()]
+    "queue",
+    [LockQueue(), LockQueue(combining=True), Queue(), QueueC(), LLQueue(),
+     ContQueue()],
 )
 def test_mutation(queue):
     queue.enqueue(1)
@@ -56,7 +65,9 @@ def test_mutation(queue):
 
 
 @pytest.mark.parametrize(
-    "queue", [LockQueue(), Queue(), QueueC(), LLQueue(), ContQueue()]
+    "queue",
+    [LockQueue(), LockQueue(combining=True), Queue(), QueueC(), LLQueue(),
+     ContQueue()],
 )
 def test_large(queue):
     for i in range(queue_size):
@@ -109,6 +120,44 @@ def test_extend(queue):
         queue.extend([1, 2], [])
 
 
+@pytest.mark.parametrize("queue", [LockQueue(), Queue(), QueueC()])
+def test_extend_iterables(queue):
+    queue.extend(i for i in range(300))
+    queue.extend(tuple(range(300, 600)))
+    queue.extend(iter(list(range(600, 1000))))
+    queue.extend(queue)
+    assert len(queue) == 2000
+    assert list(queue) == list(range(1000)) * 2
+
+    def failing():
+        yield 1
+        raise KeyError("next failed")
+
+    with pytest.raises(KeyError):
+        queue.extend(failing())
+    assert None not in list(queue)
+
+
+@pytest.mark.parametrize("queue", [Queue(max_chunk=64), QueueC()])
+def test_extend_reentrant(queue):
+    copies = []
+
+    def touching():
+        for i in range(200):
+            if i % 50 == 25:
+                copies.append(queue.copy())
+            if i % 70 == 69:
+                queue.dequeue()
+            yield i
+
+    queue.extend(touching())
+    expected = [i for i in range(200) if i not in (0, 1)]
+    assert list(queue) == expected
+    assert [list(copy) for copy in copies] == [
+        list(range(25)), list(range(1, 75)), list(range(1, 125)),
+        list(range(2, 175))]
+
+
 @pytest.mark.parametrize("queue", [LockQueue(), Queue(), QueueC()])
 def test_mixed_extend(queue):
     size = 50
@@ -203,6 +252,35 @@ def test_containsQueue(queue):
     assert '🐲' in queue
 
 
+def test_contains_wrapped():
+    queue = QueueC()
+    queue.extend(range(7))
+    for _ in range(5):
+        queue.dequeue()
+    queue.extend(range(7, 40))
+    for _ in range(30):
+        queue.enqueue(queue.dequeue())
+    items = list(queue)
+    assert all(item in queue for item in items)
+    assert not any(item in queue for item in range(2))
+    assert 40 not in queue
+
+    class Draining:
+        def __eq__(self, other):
+            queue.dequeue()
+            return False
+
+    assert Draining() not in queue
+    assert len(queue) < len(items)
+
+    class Failing:
+        def __eq__(self, other):
+            raise KeyError("eq failed")
+
+    with pytest.raises(KeyError):
+        Failing() in queue
+
+
 @pytest.mark.parametrize("queue", [LockQueue, Queue, QueueC])
 def test_initialize(queue):
     q = queue()
@@ -246,3 +324,582 @@ def test_copy(queue):
     copy = queue.copy()
     assert len(copy) == len(queue)
     assert copy.dequeue() == queue.dequeue()
+
+
+def test_llqueue_bulk():
+    queue = LLQueue()
+    assert queue.enqueue_many(range(queue_size)) == queue_size
+    assert len(queue) == queue_size
+    assert queue.enqueue_many([1, None, 2]) == 2
+    assert queue.dequeue_many(queue_size) == list(range(queue_size))
+    assert queue.dequeue_many(10) == [1, 2]
+    assert queue.is_empty()
+
+    # Slabs are reused after the queue drains
+    for _ in range(3):
+        queue.enqueue_many(range(5000))
+        assert len(queue.dequeue_many(5000)) == 5000
+    queue.enqueue("🧵")
+    assert queue.dequeue() == "🧵"
+    queue.clear()
+    assert queue.is_empty()
+
+    # A failed append leaves the item in the queue
+    queue.enqueue_many([1, 2])
+    with pytest.raises(SystemError):
+        llqueue_lib.dequeue_many(queue.queue, (), 1)
+    assert queue.dequeue_many(5) == [1, 2]
+
+    # Sparse queues fill shared slabs
+    sparse = [LLQueue() for _ in range(1000)]
+    for i, small in enumerate(sparse):
+        small.enqueue(i)
+    assert [small.dequeue() for small in sparse] == list(range(1000))
+
+
+def test_indexed_queue():
+    queue = IndexedQueue(range(queue_size))
+    assert len(queue) == queue_size
+    assert not queue.unique
+    assert (queue_size - 1) in queue
+    assert queue_size not in queue
+    assert queue.enqueue(5) is True
+    assert queue.count(5) == 2
+    assert queue.count("🐲") == 0
+    assert queue.dequeue() == 0
+    assert 0 not in queue
+    queue[0] = "🐲"
+    assert queue[0] == "🐲"
+    assert "🐲" in queue and 1 not in queue
+
+    copy = queue.copy()
+    copy.dequeue()
+    assert "🐲" in queue and "🐲" not in copy
+
+    with pytest.raises(TypeError):
+        queue.enqueue([])
+
+    # A rejected replacement leaves the index untouched
+    small = IndexedQueue([1, 2, 3])
+    with pytest.raises(TypeError):
+        small[0] = []
+    assert list(small) == [1, 2, 3]
+    assert 1 in small and small.count(1) == 1
+    with pytest.raises(IndexError):
+        small[3] = 4
+    assert 4 not in small
+
+    # Cycles through the index are collected, the type is not a Queue
+    assert not isinstance(small, Queue)
+    class Holder:
+        pass
+
+    holder = Holder()
+    holder.queue = small
+    small.enqueue(holder)
+    ref = weakref.ref(holder)
+    del small, holder
+    gc.collect()
+    assert ref() is None
+
+
+def test_indexed_queue_unique():
+    queue = IndexedQueue([1, 2, 2, 3, 1], unique=True)
+    assert queue.unique
+    assert len(queue) == 3
+    assert queue.enqueue(3) is False
+    assert queue.enqueue(4) is True
+    assert queue.count(4) == 1
+
+    with pytest.raises(ValueError):
+        queue[0] = 2
+    assert queue[0] == 1 and queue.count(1) == 1
+    queue[0] = 1
+    queue[0] = 5
+    assert 1 not in queue
+
+    assert [queue.dequeue() for _ in range(len(queue))] == [5, 2, 3, 4]
+    assert queue.enqueue(1) is True
+
+
+@pytest.mark.parametrize("queue_type", [Queue, QueueC])
+def test_splice(queue_type):
+    queue = queue_type(range(10))
+    other = queue_type(range(10, 1000))
+    queue.splice(other)
+    assert len(queue) == 1000 and len(other) == 0
+    assert other.is_empty()
+    assert queue[10] == 10 and queue[-1] == 999
+    other.enqueue("🧩")
+    assert other.dequeue() == "🧩"
+
+    # Partially drained boundary chunks on both sides
+    for _ in range(5):
+        queue.dequeue()
+    other.extend(range(1000, 1600))
+    for _ in range(300):
+        other.dequeue()
+    queue += other
+    assert len(queue) == 1295 and len(other) == 0
+    assert list(queue) == list(range(5, 1000)) + list(range(1300, 1600))
+    queue.enqueue(1600)
+    assert queue[-1] == 1600
+
+    empty = queue_type()
+    empty.splice(queue)
+    assert len(empty) == 1296 and queue.is_empty()
+    empty.splice(queue_type())
+    assert len(empty) == 1296
+    assert [empty.dequeue() for _ in range(len(empty))] == list(
+        range(5, 1000)) + list(range(1300, 1601))
+
+    # Both rings wrap around their ends
+    queue = queue_type(range(231))
+    for _ in range(100):
+        queue.dequeue()
+    other = queue_type(range(250))
+    for _ in range(200):
+        other.dequeue()
+    other.extend(range(250, 300))
+    queue.splice(other)
+    assert list(queue) == list(range(100, 231)) + list(range(200, 300))
+
+    queue = queue_type()
+    queue += [1, 2]
+    queue += queue
+    assert list(queue) == [1, 2, 1, 2]
+
+    with pytest.raises(TypeError):
+        queue.splice([1])
+    with pytest.raises(ValueError):
+        queue.splice(queue)
+
+
+@pytest.mark.parametrize("queue_type", [Queue, QueueC])
+def test_copy_on_write(queue_type):
+    queue = queue_type(range(1000))
+    snapshot = queue.copy()
+    queue[500] = "🙂"
+    queue.enqueue(1000)
+    assert queue.dequeue() == 0
+    assert snapshot[500] == 500 and queue[499] == "🙂"
+    assert len(snapshot) == 1000 and len(queue) == 1000
+
+    # Draining the snapshot leaves the original untouched
+    assert [snapshot.dequeue() for _ in range(1000)] == list(range(1000))
+    assert list(queue) == list(range(1, 500)) + ["🙂"] + list(range(501, 1001))
+
+    snapshot = queue.copy()
+    del queue
+    snapshot.enqueue("🎈")
+    assert snapshot[-1] == "🎈" and snapshot[0] == 1
+    assert len(snapshot) == 1001
+
+    item = object()
+    refs = sys.getrefcount(item)
+    queue = queue_type([item] * 300)
+    copies = [queue.copy() for _ in range(3)]
+    copies[0].dequeue()
+    copies[1][7] = item
+    copies[2].enqueue(item)
+    queue.splice(copies[2])
+    del queue, copies
+    assert sys.getrefcount(item) == refs
+
+    # Cycles through a chunk the copies share are collected
+    class Node:
+        pass
+
+    node = Node()
+    queue = queue_type(range(10))
+    queue.enqueue(node)
+    node.a, node.b = queue, queue.copy()
+    ref = weakref.ref(node)
+    del queue, node
+    gc.collect()
+    assert ref() is None
+
+    # Items stay intact while a copy still holds them
+    node = Node()
+    node.a = queue_type([node])
+    snapshot = node.a.copy()
+    del node
+    gc.collect()
+    assert isinstance(snapshot[0].a, queue_type)
+
+
+@pytest.mark.parametrize("queue_type", [Queue, QueueC])
+def test_gc_untracked(queue_type):
+    queue = queue_type(range(1000))
+    queue.extend(["🙂", b"bytes", 1.5])
+    assert not gc.is_tracked(queue)
+
+    cycle = []
+    queue.enqueue(cycle)
+    assert gc.is_tracked(queue)
+    assert gc.is_tracked(queue.copy())
+    queue[-1] = 0
+    assert not gc.is_tracked(queue)
+    queue[0] = cycle
+    assert gc.is_tracked(queue)
+    other = queue_type()
+    other.splice(queue)
+    assert gc.is_tracked(other) and not gc.is_tracked(queue)
+    other.dequeue()
+    assert not gc.is_tracked(other)
+
+    # Tuples the collector untracks while held still leave the count
+    records = queue_type([tuple([1, 2])])
+    assert gc.is_tracked(records)
+    gc.collect()
+    assert records.dequeue() == (1, 2)
+    assert not gc.is_tracked(records)
+
+    # Cycles through a queue are still collected
+    cycle.append(other)
+    other.enqueue(cycle)
+    del cycle, other
+    gc.collect()
+    assert not any(isinstance(o, queue_type) and len(o) == 1004
+                   for o in gc.get_objects())
+
+
+def test_lockqueue_contention():
+    queue = LockQueue(spin=4)
+    assert queue.spin == 4
+    queue.spin = 0
+
+    class Slow:
+        # Comparisons run Python code, so the GIL can be handed over while
+        # the queue lock is held
+        def __eq__(self, other):
+            return sum(range(50)) < 0
+
+    queue.extend([Slow() for _ in range(50)])
+
+    def work():
+        for i in range(300):
+            queue.enqueue(i)
+            assert Slow() not in queue
+            queue.dequeue()
+
+    threads = [threading.Thread(target=work) for _ in range(8)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join(timeout=60)
+        assert not thread.is_alive()
+    assert len(queue) == 50
+
+    with pytest.raises(ValueError):
+        LockQueue(spin=-1)
+    with pytest.raises(ValueError):
+        queue.spin = -5
+    assert queue.spin == 0
+    with pytest.raises(TypeError):
+        LockQueue([], 4)
+
+
+def test_lockqueue_combining():
+    queue = LockQueue(range(10), combining=True)
+    assert queue.combining and not LockQueue().combining
+    per_thread = 5000
+    results = []
+
+    def produce(start):
+        for i in range(start, start + per_thread):
+            queue.enqueue(i)
+
+    def consume():
+        taken = []
+        while len(taken) < per_thread:
+            try:
+                taken.append(queue.dequeue())
+            except IndexError:
+                pass
+        results.append(taken)
+
+    threads = [threading.Thread(target=produce, args=(i * per_thread,))
+               for i in range(4)]
+    threads += [threading.Thread(target=consume) for _ in range(4)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join(timeout=60)
+        assert not thread.is_alive()
+
+    taken = [item for chunk in results for item in chunk]
+    remaining = [queue.dequeue() for _ in range(len(queue))]
+    assert sorted(taken + remaining) == sorted(
+        list(range(10)) + list(range(4 * per_thread)))
+
+
+def test_chunk_sizing():
+    assert Queue().max_chunk == 256
+    queue = Queue(range(queue_size), max_chunk=3000)
+    assert queue.max_chunk == 4096
+    assert len(queue) == queue_size
+    assert queue[5000] == 5000 and queue[-1] == queue_size - 1
+    for i in range(queue_size // 2):
+        assert queue.dequeue() == i
+    queue.extend(range(10))
+    assert queue[queue_size // 2] == 0
+    assert list(queue)[-10:] == list(range(10))
+
+    small = Queue(max_chunk=8)
+    small.extend(range(100))
+    assert [small.dequeue() for _ in range(100)] == list(range(100))
+
+    with pytest.raises(ValueError):
+        Queue(max_chunk=4)
+    with pytest.raises(TypeError):
+        Queue([], 256)
+
+
+def test_huge_pages():
+    assert not Queue().huge_pages
+    queue = Queue(range(queue_size), max_chunk=4096, huge_pages=True)
+    assert queue.huge_pages and len(queue) == queue_size
+    copy = queue.copy()
+    for i in range(queue_size // 2):
+        assert queue.dequeue() == i
+    copy[-1] = "last"
+    assert queue[-1] == queue_size - 1 and copy[-1] == "last"
+    assert queue_size - 7 in queue and 7 in copy and 7 not in queue
+    del queue
+    assert list(copy)[:3] == [0, 1, 2]
+
+    cyclic = Queue(max_chunk=8, huge_pages=True)
+    cyclic.extend([cyclic] * 100)
+    del cyclic
+    gc.collect()
+
+
+@pytest.mark.parametrize("queue_type", [Queue, QueueC])
+def test_memory_usage(queue_type):
+    queue = queue_type()
+    empty = queue.memory_usage()
+    assert sys.getsizeof(queue) >= empty["used"] + empty["spare"]
+
+    queue.extend(range(1000))
+    usage = queue.memory_usage()
+    assert usage["used"] >= empty["used"] + 1000 * 8
+    assert queue.__sizeof__() == usage["used"] + usage["spare"]
+
+    # Copies split their shared storage between them
+    copy = queue.copy()
+    shared = copy.memory_usage()
+    assert shared == queue.memory_usage()
+    assert shared["used"] < usage["used"]
+
+    for _ in range(1000):
+        queue.dequeue()
+    assert queue.memory_usage()["used"] < usage["used"]
+
+
+def test_window_queue():
+    window = WindowQueue(3)
+    assert window.sum == 0 and window.min is None and window.mean is None
+    window.extend([12, 7, 30, 9])
+    assert list(window) == [7, 30, 9]
+    assert (window.sum, window.min, window.max) == (46, 7, 30)
+    assert window.dequeue() == 7
+    assert (window.sum, window.min, window.max) == (39, 9, 30)
+    window.enqueue(2**63 - 1)
+    window.enqueue(1.5)
+    assert window.max == float(2**63 - 1) and window.min == 1.5
+    assert isinstance(window.sum, float)
+
+    data = [(i * 7919) % 1000 for i in range(5000)]
+    window = WindowQueue(100, aggregates=["min", "mean"])
+    for i, value in enumerate(data):
+        window.enqueue(value)
+        recent = data[max(0, i - 99):i + 1]
+        assert window.min == min(recent)
+        assert window.mean == pytest.approx(sum(recent) / len(recent))
+    with pytest.raises(ValueError):
+        window.max
+
+    with pytest.raises(ValueError):
+        WindowQueue(0)
+    with pytest.raises(ValueError):
+        WindowQueue(3, aggregates=["median"])
+    with pytest.raises(TypeError):
+        WindowQueue(3).enqueue("1")
+
+
+def test_queuec_maxlen():
+    ring = QueueC(range(10), maxlen=4)
+    assert ring.maxlen == 4 and QueueC().maxlen is None
+    assert ring.snapshot() == [6, 7, 8, 9]
+    assert ring.dropped == 6
+    ring.enqueue(10)
+    assert ring.dequeue() == 7
+    ring.extend([11, 12])
+    assert ring.snapshot() == [9, 10, 11, 12]
+    assert ring.dropped == 8
+
+    copy = ring.copy()
+    ring += QueueC([13, 14])
+    assert ring.snapshot() == [11, 12, 13, 14]
+    assert copy.snapshot() == [9, 10, 11, 12]
+    assert copy.maxlen == 4 and ring.dropped == 10
+
+    with pytest.raises(ValueError):
+        QueueC(maxlen=0)
+
+
+def test_broadcast_queue():
+    broadcast = BroadcastQueue()
+    broadcast.enqueue("unseen")
+    first, second = broadcast.subscribe(), broadcast.subscribe()
+    broadcast.extend(range(100))
+    assert len(broadcast) == 100 and broadcast.subscribers == 2
+    assert [first.dequeue() for _ in range(100)] == list(range(100))
+    assert first.is_empty() and len(second) == 100 and len(broadcast) == 100
+    assert second.dequeue() == 0 and len(broadcast) == 99
+    second.close()
+    assert len(broadcast) == 0 and broadcast.subscribers == 1
+    with pytest.raises(RuntimeError):
+        second.dequeue()
+    with pytest.raises(IndexError):
+        first.dequeue()
+
+    dropping = BroadcastQueue(maxlen=3, lag="drop")
+    slow, fast = dropping.subscribe(), dropping.subscribe()
+    for i in range(5):
+        dropping.enqueue(i)
+        assert fast.dequeue() == i
+    assert [slow.dequeue() for _ in range(3)] == [2, 3, 4]
+    assert slow.dropped == 2 and fast.dropped == 0
+
+    detaching = BroadcastQueue(maxlen=3, lag="detach")
+    slow, fast = detaching.subscribe(), detaching.subscribe()
+    for i in range(4):
+        detaching.enqueue(i)
+        assert fast.dequeue() == i
+    assert slow.detached and not fast.detached
+    assert detaching.subscribers == 1
+    with pytest.raises(RuntimeError):
+        slow.dequeue()
+
+    with pytest.raises(ValueError):
+        BroadcastQueue(maxlen=3, lag="wait")
+
+
+def test_broadcast_queue_blocking():
+    broadcast = BroadcastQueue(maxlen=4)
+    subscribers = [broadcast.subscribe() for _ in range(3)]
+    received = [[] for _ in subscribers]
+
+    def consume(subscriber, items):
+        while len(items) < 1000:
+            if not subscriber.is_empty():
+                items.append(subscriber.dequeue())
+
+    threads = [
+        threading.Thread(target=consume, args=args, daemon=True)
+        for args in zip(subscribers, received)
+    ]
+    for thread in threads:
+        thread.start()
+    broadcast.extend(range(1000))
+    for thread in threads:
+        thread.join(timeout=60)
+        assert not thread.is_alive()
+    assert all(items == list(range(1000)) for items in received)
+
+
+def test_delay_queue():
+    delayed = DelayQueue(resolution=0.01)
+    now = time.monotonic()
+    delayed.enqueue_at(now + 3600, "hour")
+    delayed.enqueue_at(now + 5, "late")
+    delayed.enqueue_at(now + 1, "early")
+    delayed.enqueue_at(now - 1, "overdue")
+    assert len(delayed) == 4
+    assert delayed.pop_ready(now) == ["overdue"]
+    assert delayed.pop_ready(now + 0.5) == []
+    assert delayed.pop_ready(now + 10) == ["early", "late"]
+    assert delayed.pop_ready(now + 1e9) == ["hour"]
+    assert delayed.is_empty()
+
+    many = DelayQueue()
+    many.enqueue_after(0, "first")
+    for i in range(10000):
+        many.enqueue_after(i % 100, i)
+    ready = many.pop_ready()
+    assert ready[0] == "first"
+    ready += many.pop_ready(now + 200)
+    assert sorted(ready[1:]) == list(range(10000))
+
+    with pytest.raises(ValueError):
+        DelayQueue(resolution=0)
+    with pytest.raises(ValueError):
+        delayed.enqueue_at(float("nan"), None)
+
+
+def test_delay_queue_get():
+    delayed = DelayQueue()
+    start = time.monotonic()
+    delayed.enqueue_after(0.05, "item")
+    assert delayed.get() == "item"
+    assert time.monotonic() - start >= 0.05
+    assert delayed.get(timeout=0.01) is None
+
+    threading.Timer(0.02, delayed.enqueue_after, (0, "woken")).start()
+    assert delayed.get(timeout=5) == "woken"
+
+
+def test_work_stealing_pool():
+    pool = WorkStealingPool(4, batch=8)
+    assert pool.workers == 4 and pool.is_empty()
+    for i in range(10):
+        pool.push(0, i)
+    assert pool.pop(0) == 9
+    # Thieves take the oldest tasks and keep up to half of the rest
+    assert pool.steal(1) == 0
+    assert [pool.pop(1) for _ in range(5)] == [4, 3, 2, 1, None]
+    assert pool.steal(0) is None and pool.pop(2) is None
+
+    for i in range(100):
+        pool.submit(i)
+    seen = [pool.get(worker) for worker in range(4)]
+    assert seen[:2] == [8, 0]
+    while not pool.is_empty():
+        seen.extend(pool.get(worker) for worker in range(4))
+    expected = sorted([5, 6, 7, 8] + list(range(100)))
+    assert sorted(task for task in seen if task is not None) == expected
+
+    with pytest.raises(IndexError):
+        pool.push(4, None)
+    with pytest.raises(ValueError):
+        WorkStealingPool(0)
+
+
+def test_work_stealing_pool_threads():
+    pool = WorkStealingPool(4)
+    results = [[] for _ in range(pool.workers)]
+
+    def work(worker):
+        while not pool.is_empty():
+            task = pool.get(worker)
+            if task is not None:
+                results[worker].append(task)
+                if task < 1000:
+                    pool.push(worker, task + 1000)
+
+    for i in range(1000):
+        pool.submit(i)
+    threads = [
+        threading.Thread(target=work, args=(worker,), daemon=True)
+        for worker in range(pool.workers)
+    ]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join(timeout=60)
+        assert not thread.is_alive()
+    assert sorted(task for result in results for task in result) == list(
+        range(2000)
+    )